@@ -0,0 +1,96 @@
+#ifndef RD53B_BIT_READER_H
+#define RD53B_BIT_READER_H
+
+// std/stl
+#include <cstddef>  // size_t
+#include <cstdint>
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Sequential reader over the payload bits of the 64-bit blocks of an
+// RD53B data stream.
+//
+// Each block starts with a header (the NS bit, followed by the 2-bit chip
+// id when EnChipId = 1) that is not part of the payload. The reader keeps
+// up to 128 payload bits, MSB-aligned, in a look-ahead window and appends
+// the payload of the next block whenever fewer than 64 bits are left,
+// so any field of up to 64 bits can be peeked and consumed with a shift
+// regardless of where the block boundaries are.
+//
+// Reading past the last block yields zeros and sets past_end(). A block
+// with the NS bit set belongs to the next stream: the reader stops before
+// it, as at the last block, and flags it with unexpected_ns().
+//
+class BitReader {
+  public:
+    BitReader(const uint64_t* blocks, size_t n_blocks,
+              unsigned header_bits = 3)
+        : m_next(blocks),
+          m_end(blocks + n_blocks),
+          m_payload_bits(64 - header_bits),
+          m_payload_mask(~0ULL >> header_bits) {
+        // the header of the first block is part of the stream header and
+        // is read by the caller from the block itself
+        if (m_next != m_end) {
+            append(*m_next++);
+        }
+        refill();
+    }
+
+    // the next n bits, 1 <= n <= 64, without consuming them
+    inline uint64_t peek(unsigned n) const {
+        return static_cast<uint64_t>(m_window >> (128 - n));
+    }
+
+    inline void consume(unsigned n) {
+        m_window <<= n;
+        m_count -= n;
+        refill();
+    }
+
+    // the next n bits, 1 <= n <= 64
+    inline uint64_t read(unsigned n) {
+        uint64_t value = peek(n);
+        consume(n);
+        return value;
+    }
+
+    bool past_end() const { return m_count < 0; }
+    bool unexpected_ns() const { return m_unexpected_ns; }
+
+  private:
+    inline void refill() {
+        while (m_count <= 64 && m_next != m_end) {
+            uint64_t block = *m_next++;
+            if ((block >> 63) & 0x1) {
+                m_unexpected_ns = true;
+                m_next = m_end;
+                break;
+            }
+            append(block);
+        }
+    }
+
+    inline void append(uint64_t block) {
+        m_window |= static_cast<unsigned __int128>(block & m_payload_mask)
+                    << (128 - m_payload_bits - m_count);
+        m_count += m_payload_bits;
+    }
+
+    const uint64_t* m_next;
+    const uint64_t* m_end;
+    const int m_payload_bits;
+    const uint64_t m_payload_mask;
+    unsigned __int128 m_window = 0;
+    int m_count = 0;
+    bool m_unexpected_ns = false;
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef RD53B_CHANNEL_DEMUX_H
+#define RD53B_CHANNEL_DEMUX_H
+
+// std/stl
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// itkpix_dataflow
+#include "rd53b_decoder.h"
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Splits the 64-bit blocks of a shared link into the streams of each
+// channel (2 LS bits of the chip id).
+//
+// With data merging a primary chip forwards the streams of up to three
+// secondaries (DataMergeInMux0..3), so a single link carries at most four
+// channels. Everything is kept in fixed arrays indexed by the channel id:
+// a block costs an index and an append to a buffer that is preallocated
+// when the demux is created, with no lookups or allocations as long as
+// the streams fit in the reserved size.
+//
+// Only the channels in "channel_mask" (bit i for channel i) are expected:
+// blocks of the others are counted but neither buffered nor emitted. A
+// channel's stream is handed to the callback as soon as the channel's
+// next NS = 1 block arrives; the Stream views the channel buffer and is
+// only valid for the duration of the call.
+//
+class ChannelDemux {
+  public:
+    static constexpr unsigned n_channels = 4;
+
+    using Callback = std::function<void(const Stream&)>;
+
+    struct Counters {
+        size_t n_blocks = 0;
+        size_t n_streams = 0;
+        // blocks received before the first NS = 1 block of the channel
+        size_t n_orphan_blocks = 0;
+        // length, in blocks, of the longest stream emitted
+        size_t max_stream_blocks = 0;
+    };
+
+    explicit ChannelDemux(Callback on_stream, uint8_t channel_mask = 0xf,
+                          size_t reserve_blocks = 1024);
+    ChannelDemux(const ChannelDemux&) = delete;
+    ChannelDemux& operator=(const ChannelDemux&) = delete;
+
+    void push(uint64_t block) {
+        uint8_t ch_id = (block >> 61) & 0x3;
+        Channel& channel = m_channels[ch_id];
+        channel.counters.n_blocks++;
+        if (!channel.expected) {
+            return;
+        }
+        if ((block >> 63) & 0x1) {
+            if (channel.in_stream) {
+                emit(ch_id);
+            }
+            channel.in_stream = true;
+        } else if (!channel.in_stream) {
+            channel.counters.n_orphan_blocks++;
+            return;
+        }
+        channel.blocks.push_back(block);
+    }
+
+    // end of run: hand over the trailing stream of each channel, which no
+    // further NS = 1 block will close
+    void flush();
+
+    // drop the streams in progress, keeping the counters
+    void reset();
+
+    bool expected(uint8_t ch_id) const { return m_channels[ch_id & 0x3].expected; }
+    const Counters& counters(uint8_t ch_id) const {
+        return m_channels[ch_id & 0x3].counters;
+    }
+
+    // totals over all channels
+    size_t n_blocks() const;
+    size_t n_streams() const;
+    size_t n_orphan_blocks() const;
+    // blocks received on channels outside of the mask
+    size_t n_unexpected_blocks() const;
+
+  private:
+    void emit(uint8_t ch_id);
+
+    struct Channel {
+        std::vector<uint64_t> blocks;
+        bool expected = false;
+        bool in_stream = false;
+        Counters counters;
+    };
+
+    Callback m_on_stream;
+    std::array<Channel, n_channels> m_channels;
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
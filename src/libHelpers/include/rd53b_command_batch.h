@@ -0,0 +1,114 @@
+#ifndef RD53B_COMMAND_BATCH_H
+#define RD53B_COMMAND_BATCH_H
+
+// std/stl
+#include <array>
+#include <chrono>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <functional>
+#include <memory>  // unique_ptr
+#include <string>
+#include <vector>
+
+// yarr
+#include "Rd53b.h"
+#include "SpecController.h"
+
+// itkpix_dataflow
+#include "rd53b_register_shadow.h"
+
+namespace rd53b {
+
+namespace command {
+
+// full value of the global register at "address", as held by fe
+uint16_t register_word(const Rd53b& fe, uint32_t address);
+// set it, e.g. to restore a saved configuration
+void set_register_word(Rd53b& fe, uint32_t address, uint16_t value);
+
+//
+// Accumulates RD53B commands (register writes, clears, global pulses, ...)
+// and pushes them to the TX FIFO in bursts.
+//
+// Going through Rd53b::writeRegister costs a FIFO release per command and,
+// in the configuration sequences, a FIFO drain every few of them. Here the
+// 16-bit command words are packed back to back into the 32-bit FIFO words
+// and written in bursts of up to max_burst_words, only padded with a no-op
+// (PLL lock) word where the stream has to stop. The sequence only stops at
+// the wait points added with wait(), where the chip needs time before the
+// next command (e.g. after a reset): the FIFO is then drained and the
+// duration slept.
+//
+// The register-reference overloads keep the Rd53b configuration in sync,
+// as Rd53b::writeRegister does, and, given the chip's GlobalShadow, record
+// the write in it.
+//
+class CommandBatch {
+  public:
+    // the TX FIFO is drained between bursts so it never overflows
+    static constexpr size_t default_max_burst_words = 256;
+    static constexpr uint16_t noop_word = 0xaaaa;
+
+    explicit CommandBatch(size_t max_burst_words = default_max_burst_words);
+
+    template <size_t N>
+    void append(const std::array<uint16_t, N>& command) {
+        m_words.insert(m_words.end(), command.begin(), command.end());
+    }
+
+    void write_register(uint32_t chip_id, uint32_t address, uint16_t value) {
+        append(Rd53b::genWrReg(chip_id, address, value));
+    }
+    // e.g. write_register(fe, &Rd53b::EnCoreCol0, 0xffff)
+    template <typename Ref>
+    void write_register(Rd53b& fe, Ref ref, uint16_t value, GlobalShadow* shadow = nullptr) {
+        (fe.*ref).write(value);
+        uint32_t address = (fe.*ref).addr();
+        uint16_t word = register_word(fe, address);
+        write_register(fe.getChipId(), address, word);
+        if (shadow) shadow->record(address, word);
+    }
+    // a name that is not a plain register of fe.regMap (e.g. a virtual
+    // register spanning several) is left to Rd53b::writeNamedRegister,
+    // which writes the TX FIFO itself: it is called at its place in the
+    // sequence, with the commands before it sent out, so fe (and shadow)
+    // must outlive send()
+    void write_named_register(Rd53b& fe, const std::string& name, uint16_t value,
+                              GlobalShadow* shadow = nullptr);
+
+    void clear(uint32_t chip_id) { append(Rd53b::genClear(chip_id)); }
+    void global_pulse(uint32_t chip_id) { append(Rd53b::genGlobalPulse(chip_id)); }
+
+    // the commands after this point are only sent once the ones before it
+    // are out and "duration" has elapsed
+    void wait(std::chrono::microseconds duration = std::chrono::microseconds(0));
+
+    // push everything to the TX FIFO and empty the batch; does not wait for
+    // the FIFO to drain after the last command
+    void send(std::unique_ptr<SpecController>& hw);
+    void reset();
+
+    bool empty() const { return m_words.empty(); }
+    // 16-bit command words
+    size_t n_words() const { return m_words.size(); }
+
+  private:
+    struct WaitPoint {
+        size_t word;  // the wait is before this command word
+        std::chrono::microseconds duration;
+        std::function<void()> action;  // run after the wait, if set
+    };
+
+    void write_words(std::unique_ptr<SpecController>& hw, size_t begin, size_t end);
+
+    size_t m_max_burst_words;
+    std::vector<uint16_t> m_words;
+    std::vector<WaitPoint> m_waits;
+};
+
+};  // namespace command
+
+};  // namespace rd53b
+
+#endif
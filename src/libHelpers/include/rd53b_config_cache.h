@@ -0,0 +1,90 @@
+#ifndef RD53B_CONFIG_CACHE_H
+#define RD53B_CONFIG_CACHE_H
+
+// std/stl
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <string>
+
+// json
+#include "storage.hpp"
+
+// yarr
+#include "Rd53b.h"
+
+namespace rd53b {
+
+namespace io {
+
+//
+// Binary cache of parsed chip configurations.
+//
+// Parsing a chip JSON configuration (400 pixel columns of 384-element
+// arrays) dominates the start-up of the short-lived tools. The first time a
+// configuration is loaded, what it sets in the Rd53b configuration is
+// stored in a binary file, named after the 64-bit FNV-1a hash of the JSON
+// text: the next load of the same text only hashes it, maps the binary file
+// and copies it into the Rd53b configuration. Editing the JSON changes the
+// hash, and therefore the file used: stale entries are never read.
+//
+// Layout (host byte order):
+//   0   char[8]   magic "RD53BCFG"
+//   8   uint32_t  format version
+//   12  uint32_t  chip id
+//   16  uint64_t  FNV-1a hash of the JSON text
+//   24  uint32_t  number of global registers
+//   28  uint32_t  length of the chip name
+//   32  uint32_t  length of the "Parameter" block
+//   36  uint32_t  flags: 1 if the JSON has to be parsed, the file then
+//                 ending here
+//   40  uint16_t  global register words[number of global registers]
+//   ... chip name, then the "Parameter" block (calibration constants) as
+//       JSON text, zero padding up to a multiple of 8
+//   ... uint64_t  enable, injection enable and hitbus bitsets, a bit per
+//                 pixel (row-major), one after the other
+//   ... int8_t    TDAC[pixels] (row-major)
+//
+// The small "Parameter" block is applied with Rd53b::fromFileJson, the
+// rest is copied. Every entry is checked when it is written: it is loaded
+// back and compared with the JSON load (through toFileJson), and if the two
+// differ the entry only records that the JSON must be parsed, so a cached
+// load always gives the same configuration as a JSON load.
+//
+// The cache directory is $ITKPIX_CONFIG_CACHE if set (empty: disabled),
+// else $XDG_CACHE_HOME/itkpix_dataflow or ~/.cache/itkpix_dataflow.
+//
+class ChipConfigCache {
+  public:
+    static const uint32_t version = 2;
+
+    // an empty directory disables the cache
+    explicit ChipConfigCache(std::string directory = default_directory());
+
+    static std::string default_directory();
+    static uint64_t hash(const char* data, size_t size);
+
+    // load the chip JSON configuration "filename" into fe, from the cache
+    // if it holds it, else by parsing it (and adding it to the cache);
+    // returns true on a cache hit, throws std::runtime_error if the file
+    // can not be read
+    bool load(const std::string& filename, Rd53b& fe);
+
+    bool enabled() const { return !m_directory.empty(); }
+    // the cache file of a JSON text with this hash
+    std::string path(uint64_t hash) const;
+
+  private:
+    enum class Lookup { miss, hit, parse_json };
+
+    Lookup read(const std::string& path, uint64_t hash, Rd53b& fe) const;
+    void write(const std::string& path, uint64_t hash, Rd53b& fe,
+               const json& config) const;
+
+    std::string m_directory;
+};
+
+};  // namespace io
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef RD53B_CONFIG_SCHEDULER_H
+#define RD53B_CONFIG_SCHEDULER_H
+
+// std/stl
+#include <chrono>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <memory>  // unique_ptr
+#include <vector>
+
+// yarr
+#include "Rd53b.h"
+#include "SpecController.h"
+
+// itkpix_dataflow
+#include "rd53b_register_shadow.h"
+
+namespace rd53b {
+
+namespace command {
+
+//
+// Configures several chips, on one or more TX channels, together rather
+// than one after another.
+//
+// The SPEC has a single command FIFO, whose stream goes out on every
+// enabled TX channel, and each chip only acts on the commands addressed to
+// its chip id or to the broadcast id 16. So, with the TX channels of
+// several chips enabled:
+//
+//  - the reset sequence of configure_init, identical for all chips, is
+//    sent once with the broadcast id, and its pauses are paid once;
+//  - a global register holding the same value for all chips is written
+//    once, with the broadcast id; the others are written chip by chip in
+//    the same stream, and only the registers that differ from what the
+//    chip holds (see GlobalShadow) are written at all;
+//  - the stream only stops where the chips need time (after the preamp
+//    bias register), once for all chips, and to drain the FIFO.
+//
+// Chips that can not be told apart, i.e. with the same chip id on
+// different TX channels, are configured in separate rounds, each with
+// only the TX channels of its chips enabled.
+//
+// A chip can depend on another one (after()), e.g. a SECONDARY that only
+// follows the commands relayed by its PRIMARY some time after the PRIMARY
+// is configured. The chips are then configured in stages, each starting
+// once the chips it depends on are configured and the delay has elapsed.
+// Only the first stage uses broadcasts: in the later ones they would also
+// reach the chips already configured, so the reset sequence and the
+// registers are addressed to each chip.
+//
+// A broadcast reaches every chip on the enabled TX channels: all the chips
+// on the TX channels used should be added.
+//
+class ConfigScheduler {
+  public:
+    static constexpr uint32_t broadcast_chip_id = 16;
+
+    // fe and shadow must outlive the scheduler; returns the index of the
+    // chip, for after()
+    size_t add(Rd53b& fe, GlobalShadow& shadow);
+    // configure "chip" only once "dependency", added before it, is
+    // configured and "delay" has elapsed
+    void after(size_t chip, size_t dependency, std::chrono::milliseconds delay);
+
+    size_t n_chips() const { return m_chips.size(); }
+    // number of groups of chips configured one after the other, waiting
+    // for the ones they depend on
+    size_t n_stages() const;
+    // number of groups of TX channels configured one after the other
+    size_t n_rounds() const { return m_rounds.size(); }
+
+    // enable the TX channels of all chips
+    void enable_all(std::unique_ptr<SpecController>& hw) const;
+
+    // as rd53b::helpers::configure_init, for all chips at once, leaving
+    // each chip's configuration as it does (the registers of the reset
+    // sequence at their last written value); the chips are reset, so the
+    // shadows are invalidated
+    void configure_init(std::unique_ptr<SpecController>& hw);
+    // write the global registers that differ from the shadows, returning
+    // the number of register writes sent (a broadcast counts once)
+    size_t configure_global(std::unique_ptr<SpecController>& hw);
+    // the pixel matrices, chip by chip
+    void configure_pixels(std::unique_ptr<SpecController>& hw);
+    // all of the above, stage by stage with the delays of after(), leaving
+    // the TX channels of all chips enabled
+    void configure(std::unique_ptr<SpecController>& hw);
+
+  private:
+    static constexpr size_t no_dependency = static_cast<size_t>(-1);
+
+    struct Chip {
+        Rd53b* fe;
+        GlobalShadow* shadow;
+        size_t dependency;
+        std::chrono::milliseconds delay;
+        size_t stage;
+    };
+    struct Round {
+        size_t stage;
+        std::vector<uint32_t> tx_channels;
+        std::vector<size_t> chips;  // indices in m_chips
+    };
+
+    void assign_rounds();
+    void configure_init(std::unique_ptr<SpecController>& hw, size_t stage);
+    size_t configure_global(std::unique_ptr<SpecController>& hw, size_t stage);
+    size_t configure_global(std::unique_ptr<SpecController>& hw, const Round& round);
+    void configure_pixels(std::unique_ptr<SpecController>& hw, size_t stage);
+
+    std::vector<Chip> m_chips;
+    std::vector<Round> m_rounds;
+};
+
+};  // namespace command
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef RD53B_DECODER_H
+#define RD53B_DECODER_H
+
+// std/stl
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// itkpix_dataflow
+#include "rd53b_event_buffer.h"
+
+namespace rd53b {
+
+namespace decoder {
+
+// non-owning view of consecutive 64-bit blocks
+struct BlockSpan {
+    const uint64_t* ptr = nullptr;
+    size_t len = 0;
+
+    const uint64_t* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    const uint64_t* begin() const { return ptr; }
+    const uint64_t* end() const { return ptr + len; }
+    uint64_t operator[](size_t i) const { return ptr[i]; }
+};
+
+// a single RD53B data stream: the consecutive 64-bit blocks received for
+// one chip (identified by the 2 LS bits of its chip id), starting with
+// the block that has the NS bit set
+//
+// a Stream does not own its blocks, it views a buffer that must outlive it
+struct Stream {
+    uint8_t chip_id = 0;
+    BlockSpan blocks;
+};
+
+// the ways in which a stream can turn out to be corrupted
+enum class DecodeError : uint8_t {
+    no_tot = 0,     // a quarter core without any hit
+    past_end,       // the stream ends in the middle of a quarter core
+    bad_address,    // core column or quarter row out of the matrix
+    unexpected_ns,  // a stream runs into a block with the NS bit set
+};
+const unsigned n_decode_errors = 4;
+
+const char* to_string(DecodeError error);
+
+// number of streams dropped for each kind of error
+struct DecodeErrors {
+    std::array<size_t, n_decode_errors> n = {};
+
+    size_t count(DecodeError error) const {
+        return n[static_cast<unsigned>(error)];
+    }
+    size_t total() const {
+        size_t sum = 0;
+        for (auto n_error : n) sum += n_error;
+        return sum;
+    }
+    void clear() { n.fill(0); }
+    DecodeErrors& operator+=(const DecodeErrors& other) {
+        for (unsigned i = 0; i < n_decode_errors; i++) n[i] += other.n[i];
+        return *this;
+    }
+};
+
+// split a capture into streams
+//
+// The blocks are regrouped by channel (2 LS bits of the chip id) into
+// "storage", which is resized to hold each block exactly once: every
+// channel's blocks are adjacent and in arrival order, so each stream is a
+// view into "storage". A stream is complete once the next NS = 1 block of
+// its channel is seen: blocks before the first NS = 1 block are not
+// returned, nor is the trailing, possibly incomplete, stream of each
+// channel unless "keep_last" is set (for captures that end on a stream
+// boundary, like a run file).
+std::map<unsigned, std::vector<Stream>> build_streams(
+    BlockSpan blocks, std::vector<uint64_t>& storage, bool keep_last = false);
+
+inline std::map<unsigned, std::vector<Stream>> build_streams(
+    const std::vector<uint64_t>& blocks, std::vector<uint64_t>& storage,
+    bool keep_last = false) {
+    return build_streams(BlockSpan{blocks.data(), blocks.size()}, storage,
+                         keep_last);
+}
+
+// decode all events contained in a single stream and append them to
+// "events", returning how many were appended (none when the stream has no
+// hits); pixel addresses are 0-based, (col, row) in [0, 400) x [0, 384)
+//  drop_tot:             the chip does not send ToT (DataEnBinaryRo = 1)
+//  do_compressed_hitmap: hitmaps are binary-tree encoded
+//  use_ptot:             the chip is configured for PToT/PToA readout
+//
+// throws std::runtime_error on corrupted data
+size_t decode_stream(const Stream& stream, EventBuffer& events,
+                     bool drop_tot = false, bool do_compressed_hitmap = false,
+                     bool use_ptot = false);
+
+// error-resilient version of decode_stream, for long captures: a corrupted
+// stream is dropped as a whole, without appending any of its events, and
+// its error is counted in "errors" instead of thrown; decoding resumes
+// cleanly with the next stream, i.e. at the next NS = 1 block of the
+// channel
+size_t decode_stream(const Stream& stream, EventBuffer& events,
+                     DecodeErrors& errors, bool drop_tot = false,
+                     bool do_compressed_hitmap = false, bool use_ptot = false);
+
+// same, also appending to "tags" the tag of every event of the stream (the
+// stream tag, then the 11-bit internal tags), including the events of a
+// stream without any hit, which are not appended to "events": one tag per
+// trigger the chip answered; nothing is appended for a dropped stream
+size_t decode_stream(const Stream& stream, EventBuffer& events,
+                     std::vector<uint16_t>& tags, DecodeErrors& errors,
+                     bool drop_tot = false, bool do_compressed_hitmap = false,
+                     bool use_ptot = false);
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef RD53B_EMULATOR_H
+#define RD53B_EMULATOR_H
+
+// std/stl
+#include <chrono>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// json
+#include "storage.hpp"
+
+// yarr
+#include "RawData.h"
+#include "SpecController.h"
+
+// itkpix_dataflow
+#include "rd53b_encoder.h"
+#include "rd53b_event_buffer.h"
+
+namespace rd53b {
+
+namespace emulator {
+
+// "type" of the "ctrlCfg" of a hw config that selects the emulator
+const std::string controller_type = "rd53b_emu";
+
+//
+// Software stand-in for the SPEC card and the RD53B chips behind it.
+//
+// The commands written to the FIFO are accepted and dropped. Once the
+// trigger is enabled in run mode, each trigger (one playback of the
+// trigger word) produces one event per trigger command of the word and
+// per bunch crossing of its pattern, in every emulated chip, tagged as
+// the chip would tag it. The events are filled with random hits and
+// encoded with rd53b::encoder::StreamEncoder into the Aurora blocks the
+// chips would send, which readData() returns as 32-bit words with the
+// blocks of the different chips interleaved, as on a shared link.
+//
+// The triggers fire on their own once enabled: all at once ("realTime":
+// false), or at the trigger frequency, isTrigDone() reporting when the
+// last one has fired. Their data are generated when they are read out,
+// and are still served after the trigger is disabled, as the DMA would,
+// until flushBuffer() drops them.
+//
+// Configuration, the "cfg" of the "ctrlCfg" of the hw config:
+//   chipIds:           chip ids of the emulated chips ([15])
+//   occupancy:         probability for a pixel to be hit in an event (1e-4)
+//   compressedHitmap:  binary-tree encode the hitmaps (true)
+//   dropTot:           do not send ToT (false)
+//   ptot:              send PToT/PToA records instead of ToT (false)
+//   eventsPerStream:   events in each stream, NumOfEventsInStream (1)
+//   triggersPerRead:   maximum number of triggers per readData() (64)
+//   realTime:          pace the triggers with the trigger frequency (false)
+//   seed:              random seed (1)
+//
+class EmulatedSpecController : public SpecController {
+  public:
+    EmulatedSpecController();
+    ~EmulatedSpecController() override = default;
+
+    void configure_emulation(const json& config);
+
+    // TxCore
+    void writeFifo(uint32_t value) override;
+    void releaseFifo() override {}
+    void setCmdEnable(uint32_t value) override { m_cmd_enable = value; }
+    void setCmdEnable(std::vector<uint32_t> channels) override;
+    uint32_t getCmdEnable() override { return m_cmd_enable; }
+    void disableCmd() override { m_cmd_enable = 0; }
+    bool isCmdEmpty() override { return true; }
+
+    void setTrigEnable(uint32_t value) override;
+    uint32_t getTrigEnable() override;
+    void setTrigConfig(enum TRIG_CONF_VALUE cfg) override;
+    void setTrigFreq(double freq) override;
+    void setTrigCnt(uint32_t count) override;
+    void setTrigTime(double time) override;
+    void setTrigWordLength(uint32_t length) override;
+    void setTrigWord(uint32_t* word, uint32_t size) override;
+    bool isTrigDone() override;
+
+    // RxCore
+    void setRxEnable(uint32_t value) override { m_rx_enable = value; }
+    void setRxEnable(std::vector<uint32_t> channels) override;
+    void disableRx() override { m_rx_enable = 0; }
+    RawData* readData() override;
+    void flushBuffer() override;
+
+    // HwController
+    void setupMode() override;
+    void runMode() override;
+
+    // number of commands written to the FIFO
+    size_t n_cmd_words() const { return m_n_cmd_words; }
+
+  private:
+    // total number of triggers of the run, and those due by now
+    size_t n_triggers_total() const;
+    size_t n_triggers_due() const;
+    // triggers fired since the start, including the finished runs
+    size_t n_triggers_fired() const;
+    void generate_event(uint16_t tag, rd53b::decoder::EventBuffer& events);
+
+    std::mutex m_mutex;
+
+    // emulation settings
+    std::vector<uint8_t> m_chip_ids = {15};
+    double m_occupancy = 1e-4;
+    bool m_compressed_hitmap = true;
+    bool m_drop_tot = false;
+    bool m_use_ptot = false;
+    unsigned m_events_per_stream = 1;
+    size_t m_triggers_per_read = 64;
+    bool m_real_time = false;
+    std::mt19937_64 m_rng{1};
+
+    // controller state
+    uint32_t m_cmd_enable = 0;
+    uint32_t m_rx_enable = 0;
+    bool m_run_mode = false;
+    uint32_t m_trig_enable = 0;
+    enum TRIG_CONF_VALUE m_trig_config = INT_COUNT;
+    double m_trig_freq = 1000;
+    uint32_t m_trig_count = 0;
+    double m_trig_time = 0;
+    // tags of the events of one trigger, from the trigger word
+    std::vector<uint16_t> m_trigger_tags = {0};
+    std::chrono::steady_clock::time_point m_trig_start;
+    // triggers fired by the finished runs, and those read out
+    size_t m_n_triggers_fired = 0;
+    size_t m_n_triggers_sent = 0;
+    size_t m_n_cmd_words = 0;
+
+    // generation buffers, reused across reads
+    rd53b::encoder::StreamEncoder m_encoder;
+    rd53b::decoder::EventBuffer m_events;
+    std::vector<std::vector<uint64_t>> m_chip_blocks;
+    std::vector<uint32_t> m_pixels;
+};
+
+};  // namespace emulator
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef RD53B_ENCODER_H
+#define RD53B_ENCODER_H
+
+// std/stl
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <vector>
+
+// itkpix_dataflow
+#include "rd53b_event_buffer.h"
+
+namespace rd53b {
+
+namespace encoder {
+
+//
+// Writes events as RD53B data streams, the inverse of
+// rd53b::decoder::decode_stream.
+//
+// The binary-tree hitmap codes and the order of the ToT values within a
+// quarter core are not written down here: they are derived, once, by
+// inverting the same YARR lookup tables that the decoder uses, so that
+// whatever is encoded decodes back to the same hits.
+//
+// Hits are taken from an EventBuffer in the decoder's conventions (0-based
+// col and row, 4-bit ToT, packed PToT/PToA) and may be in any order. ToT
+// hits must have a non-zero ToT, as a ToT of 0 is dropped by the decoder.
+// A PToT hit is reported on the hit bus of its core column given by
+// col % 8 (0 to 3), and its row is ignored.
+//
+class StreamEncoder {
+  public:
+    //  compressed_hitmap: binary-tree encode the hitmaps (DataEnRaw = 0)
+    //  drop_tot:          do not send ToT (DataEnBinaryRo = 1)
+    //  use_ptot:          write PToT/PToA records instead of ToT
+    explicit StreamEncoder(bool compressed_hitmap = false,
+                           bool drop_tot = false, bool use_ptot = false);
+
+    // append, to "blocks", one stream with events [first_event,
+    // first_event + n_events) of "events", for the chip whose 2 LS bits
+    // of the chip id are "chip_id"
+    //
+    // The first event's tag is sent in the 8-bit stream header, and the
+    // following ones as 11-bit internal tags: tags below 0x700 are sent as
+    // 0x700 | (tag & 0xff), which is also what the decoder returns for them.
+    void encode(const rd53b::decoder::EventBuffer& events, size_t first_event,
+                size_t n_events, uint8_t chip_id,
+                std::vector<uint64_t>& blocks);
+
+  private:
+    bool m_compressed_hitmap;
+    bool m_drop_tot;
+    bool m_use_ptot;
+
+    // per event scratch: a sort key and the hit index, for every hit
+    std::vector<uint64_t> m_order;
+};
+
+};  // namespace encoder
+
+};  // namespace rd53b
+
+#endif
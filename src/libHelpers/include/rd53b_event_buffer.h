@@ -0,0 +1,131 @@
+#ifndef RD53B_EVENT_BUFFER_H
+#define RD53B_EVENT_BUFFER_H
+
+// std/stl
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <vector>
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Columnar (structure-of-arrays) storage for decoded events.
+//
+// All hits of all events live in one shared set of columns, and an event
+// is its tag plus the offset of its first hit. The columns are carved out
+// of a single 64-byte aligned arena that only grows: clear() keeps the
+// memory, so a buffer that is reused across streams stops allocating once
+// it has seen its largest stream.
+//
+// Column types:
+//  col, row:  uint16_t, 0-based pixel address
+//  tot:       uint8_t, 4-bit ToT (0 for PToT hits)
+//  ptot_ptoa: uint16_t, the 11-bit PToT and 5-bit PToA packed as they are
+//             read out, PToA in the 5 MSBs (0 for ToT hits)
+//
+class EventBuffer {
+  public:
+    EventBuffer() = default;
+    explicit EventBuffer(size_t hit_capacity, size_t event_capacity = 0);
+    ~EventBuffer();
+    EventBuffer(const EventBuffer&) = delete;
+    EventBuffer& operator=(const EventBuffer&) = delete;
+    EventBuffer(EventBuffer&& other) noexcept;
+    EventBuffer& operator=(EventBuffer&& other) noexcept;
+
+    // drop all events, keeping the memory for reuse
+    void clear() {
+        m_n_hits = 0;
+        m_tag.clear();
+        m_hit_offset.clear();
+    }
+
+    // drop all events from the n-th on
+    void truncate(size_t n_events);
+
+    void reserve(size_t hit_capacity, size_t event_capacity = 0);
+
+    // append a copy of n_events events of "other" from its first_event-th
+    // on, all of them by default
+    void append(const EventBuffer& other, size_t first_event = 0,
+                size_t n_events = static_cast<size_t>(-1));
+
+    void begin_event(uint16_t tag) {
+        m_tag.push_back(tag);
+        m_hit_offset.push_back(static_cast<uint32_t>(m_n_hits));
+    }
+
+    void add_hit(uint16_t col, uint16_t row, uint8_t tot,
+                 uint16_t ptot_ptoa = 0) {
+        if (m_n_hits == m_capacity) {
+            grow(m_n_hits + 1);
+        }
+        m_col[m_n_hits] = col;
+        m_row[m_n_hits] = row;
+        m_tot[m_n_hits] = tot;
+        m_ptot_ptoa[m_n_hits] = ptot_ptoa;
+        m_n_hits++;
+    }
+
+    // make room for n more hits and return the index of the first one,
+    // the caller fills all n of them through the column pointers
+    size_t extend(size_t n) {
+        if (m_n_hits + n > m_capacity) {
+            grow(m_n_hits + n);
+        }
+        size_t first = m_n_hits;
+        m_n_hits += n;
+        return first;
+    }
+
+    // give back hits added by extend() that were not filled
+    void shrink(size_t n) { m_n_hits -= n; }
+
+    size_t n_events() const { return m_tag.size(); }
+    size_t n_hits() const { return m_n_hits; }
+    size_t capacity() const { return m_capacity; }
+
+    uint16_t tag(size_t ievent) const { return m_tag[ievent]; }
+    size_t hit_begin(size_t ievent) const { return m_hit_offset[ievent]; }
+    size_t hit_end(size_t ievent) const {
+        return ievent + 1 < m_hit_offset.size() ? m_hit_offset[ievent + 1]
+                                                 : m_n_hits;
+    }
+    size_t n_hits(size_t ievent) const {
+        return hit_end(ievent) - hit_begin(ievent);
+    }
+
+    const uint16_t* col() const { return m_col; }
+    const uint16_t* row() const { return m_row; }
+    const uint8_t* tot() const { return m_tot; }
+    const uint16_t* ptot_ptoa() const { return m_ptot_ptoa; }
+    uint16_t* col() { return m_col; }
+    uint16_t* row() { return m_row; }
+    uint8_t* tot() { return m_tot; }
+    uint16_t* ptot_ptoa() { return m_ptot_ptoa; }
+
+    uint16_t ptot(size_t ihit) const { return m_ptot_ptoa[ihit] & 0x7ff; }
+    uint8_t ptoa(size_t ihit) const { return m_ptot_ptoa[ihit] >> 11; }
+
+  private:
+    void grow(size_t min_capacity);
+
+    void* m_arena = nullptr;
+    size_t m_capacity = 0;
+    size_t m_n_hits = 0;
+    uint16_t* m_col = nullptr;
+    uint16_t* m_row = nullptr;
+    uint16_t* m_ptot_ptoa = nullptr;
+    uint8_t* m_tot = nullptr;
+
+    std::vector<uint16_t> m_tag;
+    std::vector<uint32_t> m_hit_offset;
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
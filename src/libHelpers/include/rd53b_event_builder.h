@@ -0,0 +1,133 @@
+#ifndef RD53B_EVENT_BUILDER_H
+#define RD53B_EVENT_BUILDER_H
+
+// std/stl
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <functional>
+
+// itkpix_dataflow
+#include "rd53b_event_buffer.h"
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// One trigger as seen by all the chips sharing a link: the event of each
+// chip (by the 2 LS bits of its chip id) that sent one for that trigger.
+//
+// The hits of a chip's event are [hit_begin(ch_id), hit_end(ch_id)) in the
+// columns of hits().
+//
+class BuiltEvent {
+  public:
+    uint8_t tag() const { return m_tag; }
+    // channels that sent an event for this trigger
+    uint8_t chip_mask() const { return m_chip_mask; }
+    bool has(unsigned ch_id) const { return (m_chip_mask >> ch_id) & 0x1; }
+    // emitted before every expected chip was known to have sent or skipped
+    // its event, because the reorder window was full
+    bool forced() const { return m_forced; }
+
+    const EventBuffer& hits() const { return *m_hits; }
+    size_t hit_begin(unsigned ch_id) const {
+        return has(ch_id) ? m_hits->hit_begin(m_event[ch_id]) : 0;
+    }
+    size_t hit_end(unsigned ch_id) const {
+        return has(ch_id) ? m_hits->hit_end(m_event[ch_id]) : 0;
+    }
+    size_t n_hits(unsigned ch_id) const { return hit_end(ch_id) - hit_begin(ch_id); }
+    size_t n_hits() const { return m_hits->n_hits(); }
+
+  private:
+    friend class EventBuilder;
+
+    uint8_t m_tag = 0;
+    uint8_t m_chip_mask = 0;
+    bool m_forced = false;
+    std::array<size_t, 4> m_event = {0, 0, 0, 0};
+    const EventBuffer* m_hits = nullptr;
+};
+
+//
+// Aligns the decoded events of the chips sharing a link by trigger tag.
+//
+// Events are matched on their 8-bit tag (the trigger tag and bunch
+// crossing), i.e. the stream tag or the 8 LS bits of an 11-bit internal
+// tag. Every chip sends its events in trigger order, but not necessarily
+// one per trigger: streams without hits give no event, and corrupted
+// streams may be dropped. The events of each chip are therefore queued,
+// and the oldest pending tag is emitted as soon as every expected chip has
+// either sent it or already sent a later one. Tags are ordered by their
+// distance, modulo 256, from the last emitted tag, so the order survives
+// the tag rollover as long as the chips are less than 128 tags apart.
+//
+// A chip that stays silent would hold everything back, so the latency is
+// bounded by a reorder window: once more than "window" events are
+// pending, the oldest tag is emitted with the chips that have it
+// (forced()). An event that arrives after its tag was emitted this way is
+// emitted on its own as soon as it arrives (counted in n_late()).
+// flush() emits everything left at the end of a run.
+//
+class EventBuilder {
+  public:
+    static constexpr unsigned n_channels = 4;
+    using Callback = std::function<void(const BuiltEvent&)>;
+
+    explicit EventBuilder(Callback on_event, uint8_t channel_mask = 0xf,
+                          size_t window = 64);
+
+    // queue all events decoded for channel ch_id and emit what can be
+    void push(unsigned ch_id, const EventBuffer& events);
+    void flush();
+    void reset();
+
+    size_t n_events() const { return m_n_events; }
+    // events that not every expected chip sent
+    size_t n_partial() const { return m_n_partial; }
+    size_t n_forced() const { return m_n_forced; }
+    size_t n_late() const { return m_n_late; }
+    size_t n_pending() const { return m_n_pending; }
+
+  private:
+    struct Queue {
+        EventBuffer events;
+        size_t head = 0;
+
+        bool empty() const { return head == events.n_events(); }
+        uint8_t front_tag() const { return events.tag(head) & 0xff; }
+    };
+
+    // emit the oldest pending tag, if it is complete or "force" is set;
+    // false when nothing was emitted
+    bool emit(bool force);
+    // distance of a tag from the last emitted one, modulo 256 in
+    // [-128, 128): the smallest is the oldest
+    int8_t distance(uint8_t tag) const { return static_cast<int8_t>(tag - m_last_tag); }
+
+    Callback m_on_event;
+    uint8_t m_channel_mask;
+    size_t m_window;
+
+    std::array<Queue, n_channels> m_queues;
+    EventBuffer m_compact;
+    EventBuffer m_built;
+    BuiltEvent m_event;
+    bool m_started = false;
+    bool m_emitted = false;
+    uint8_t m_last_tag = 0;
+
+    size_t m_n_pending = 0;
+    size_t m_n_events = 0;
+    size_t m_n_partial = 0;
+    size_t m_n_forced = 0;
+    size_t m_n_late = 0;
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
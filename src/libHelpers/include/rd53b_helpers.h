@@ -2,6 +2,7 @@
 #define RD53B_HELPERS_H
 
 // std/stl
+#include <chrono>
 #include <memory>  // shared_ptr
 #include <string>
 
@@ -15,13 +16,32 @@
 // class Rd53b;
 #include "Rd53b.h"
 
+// itkpix_dataflow
+#include "rd53b_command_batch.h"
+#include "rd53b_pixel_shadow.h"
+#include "rd53b_register_shadow.h"
+#include "rd53b_trigger.h"
+#include "rd53b_wait.h"
+
 namespace rd53b {
 
 namespace helpers {
 std::unique_ptr<SpecController> spec_init(std::string config);
 bool spec_init_trigger(std::unique_ptr<SpecController>& hw,
                        json trigger_config);
-bool spec_trigger_loop(std::unique_ptr<SpecController>& hw);
+// same, from a parsed configuration, writing only the trigger settings that
+// differ from what "loader" last programmed
+bool spec_init_trigger(std::unique_ptr<SpecController>& hw,
+                       const rd53b::trigger::TriggerConfig& trigger_config,
+                       rd53b::trigger::TriggerLoader& loader);
+// start the triggers and wait for them to be done; throws
+// std::runtime_error if they are not done within "timeout"
+bool spec_trigger_loop(std::unique_ptr<SpecController>& hw,
+                       std::chrono::milliseconds timeout);
+// same, with the timeout derived from the trigger configuration loaded
+// (see rd53b::trigger::done_timeout)
+bool spec_trigger_loop(std::unique_ptr<SpecController>& hw,
+                       const rd53b::trigger::TriggerConfig& trigger_config);
 
 std::unique_ptr<Rd53b> rd53b_init(std::unique_ptr<SpecController>& hw,
                                   std::string config);
@@ -29,6 +49,19 @@ void rd53b_configure(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>
 void configure_init(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe);
 void configure_global(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe);
 void configure_pixels(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe);
+// the commands of configure_init after the CMD decoder sync (resets, core
+// column resets, clear), addressed to the chip id of fe
+void init_sequence(rd53b::command::CommandBatch& batch, Rd53b& fe);
+
+// same, keeping track of the global registers written in "shadow"
+void rd53b_configure(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe,
+                     rd53b::command::GlobalShadow& shadow);
+void configure_global(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe,
+                      rd53b::command::GlobalShadow& shadow);
+// write only the global registers whose value in fe the chip may not hold
+// according to "shadow", returning how many were written
+size_t configure_diff(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe,
+                      rd53b::command::GlobalShadow& shadow);
 bool rd53b_reset(std::unique_ptr<SpecController>& hw,
                  std::unique_ptr<Rd53b>& fe);
 
@@ -36,8 +69,20 @@ bool clear_tot_memories(std::unique_ptr<SpecController>& hw,
                         std::unique_ptr<Rd53b>& fe,
                         float pixel_fraction = 100.0);
 bool disable_pixels(std::unique_ptr<Rd53b>& fe);
-void set_core_columns(std::unique_ptr<Rd53b>& fe,
+// same, only writing the pixel registers that change; returns how many
+// were written
+size_t disable_pixels(std::unique_ptr<SpecController>& hw,
+                      std::unique_ptr<Rd53b>& fe,
+                      rd53b::command::PixelShadow& pixels);
+// enable (and reset) the core columns set in "cores", 16 per word
+void set_core_columns(std::unique_ptr<SpecController>& hw,
+                      std::unique_ptr<Rd53b>& fe,
                       std::array<uint16_t, 4> cores);
+// same, appending the register writes to a command batch, recorded in
+// "shadow" if given
+void set_core_columns(rd53b::command::CommandBatch& batch, Rd53b& fe,
+                      std::array<uint16_t, 4> cores,
+                      rd53b::command::GlobalShadow* shadow = nullptr);
 
 };  // namespace helpers
 
@@ -0,0 +1,55 @@
+#ifndef RD53B_HIT_KERNELS_H
+#define RD53B_HIT_KERNELS_H
+
+// std/stl
+#include <cstddef>  // size_t
+#include <cstdint>
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Kernels expanding the hits of one quarter core, i.e. a 16-bit hitmap and
+// its ToT field (ToT of the i-th hit of the hitmap in the i-th nibble),
+// into the hit columns of an EventBuffer.
+//
+// All 16 slots from the output pointers must be writable: the vector
+// kernels always store 16 lanes. The hits are written in hitmap order and
+// the number written is returned; hits with a ToT of 0 are dropped unless
+// "keep_all" is set (no ToT readout, the ToT field is then 0).
+//
+using ExpandHitsFn = size_t (*)(uint16_t hitmap, uint64_t tot_field,
+                                uint16_t col_base, uint16_t row_base,
+                                bool keep_all, uint16_t* col, uint16_t* row,
+                                uint8_t* tot, uint16_t* ptot_ptoa);
+
+size_t expand_hits_scalar(uint16_t hitmap, uint64_t tot_field,
+                          uint16_t col_base, uint16_t row_base, bool keep_all,
+                          uint16_t* col, uint16_t* row, uint8_t* tot,
+                          uint16_t* ptot_ptoa);
+
+#if defined(__x86_64__)
+// SSE4.1 and AVX2 versions, only to be called when the CPU supports them
+size_t expand_hits_sse4(uint16_t hitmap, uint64_t tot_field,
+                        uint16_t col_base, uint16_t row_base, bool keep_all,
+                        uint16_t* col, uint16_t* row, uint8_t* tot,
+                        uint16_t* ptot_ptoa);
+size_t expand_hits_avx2(uint16_t hitmap, uint64_t tot_field,
+                        uint16_t col_base, uint16_t row_base, bool keep_all,
+                        uint16_t* col, uint16_t* row, uint8_t* tot,
+                        uint16_t* ptot_ptoa);
+#endif
+
+// the fastest kernel the CPU supports, chosen once at runtime
+//
+// The choice can be forced with the ITKPIX_HIT_KERNEL environment
+// variable ("scalar", "sse4" or "avx2"), to compare them.
+ExpandHitsFn expand_hits_kernel();
+const char* expand_hits_kernel_name();
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef RD53B_HITMAP_DECODER_H
+#define RD53B_HITMAP_DECODER_H
+
+// std/stl
+#include <cstdint>
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Decompression of binary-tree encoded hitmaps in a single step.
+//
+// A compressed hitmap is at most 30 bits long: the code of the first row
+// (with the bits telling which rows are hit), up to 16 bits, then the code
+// of the second row, up to 14 bits. The decoder takes the next 30 bits of
+// the stream at once and resolves the whole hitmap and its length with one
+// probe of each of its two tables, without branching on whether the second
+// row is there, so the caller consumes the code in one go.
+//
+// The tables are built once from YARR's _LUT_BinaryTreeHitMap and
+// _LUT_BinaryTreeRowHMap, with the consumed lengths stored directly
+// instead of as roll-backs.
+//
+class HitmapDecoder {
+  public:
+    static constexpr unsigned max_code_bits = 30;
+
+    static const HitmapDecoder& instance();
+
+    // the hitmap coded at the MSB of the next "max_code_bits" bits of the
+    // stream, and the length of its code in n_bits
+    inline uint16_t decode(uint32_t code, unsigned& n_bits) const {
+        uint32_t first = m_first[code >> 14];
+        unsigned first_bits = (first >> 16) & 0x1f;
+        uint16_t second = m_second[(code >> (16 - first_bits)) & 0x3fff];
+        // all ones when the second row follows, zero otherwise
+        uint32_t has_second = 0u - (first >> 24);
+        n_bits = first_bits + ((second >> 8) & has_second);
+        return (first & 0xffff) | ((static_cast<uint32_t>(second & 0xff) << 8) & has_second);
+    }
+
+  private:
+    HitmapDecoder();
+
+    // first part of the code, by its 16 MS bits:
+    //   bits 0-15: hitmap (only the first row when the second row follows)
+    //   bits 16-20: length of the first part
+    //   bit 24: the second row follows
+    uint32_t m_first[1 << 16];
+    // second row, by the 14 bits after the first part:
+    //   bits 0-7: row, bits 8-15: length
+    uint16_t m_second[1 << 14];
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
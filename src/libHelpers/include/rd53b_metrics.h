@@ -0,0 +1,152 @@
+#ifndef RD53B_METRICS_H
+#define RD53B_METRICS_H
+
+// std/stl
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// json
+#include "storage.hpp"
+
+namespace rd53b {
+
+namespace metrics {
+
+//
+// Instrumentation of the acquisition pipeline: counters and histograms
+// filled by the stages of the pipeline (trigger setup, DMA readout, stream
+// building, decoding), summarised per run as JSON.
+//
+// The stages record through the RD53B_METRICS_* macros below, which only
+// do something when built with ITKPIX_INSTRUMENTATION defined (the CMake
+// option of the same name): otherwise they compile to nothing and the
+// summary is empty. When enabled, recording is a few relaxed atomic
+// operations, safe from any thread; the name lookup is done once per call
+// site.
+//
+#if defined(ITKPIX_INSTRUMENTATION)
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+class Counter {
+  public:
+    void add(uint64_t n) { m_count.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    void reset() { m_count = 0; }
+
+  private:
+    std::atomic<uint64_t> m_count{0};
+};
+
+//
+// Histogram of a non-negative quantity in power-of-two buckets: bucket 0
+// holds 0 and bucket i > 0 holds [2^(i-1), 2^i).
+//
+class Histogram {
+  public:
+    static constexpr unsigned n_buckets = 65;
+
+    explicit Histogram(std::string unit) : m_unit(std::move(unit)) {}
+
+    void add(uint64_t value) {
+        unsigned ibucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        m_buckets[ibucket].fetch_add(1, std::memory_order_relaxed);
+        m_n.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t min = m_min.load(std::memory_order_relaxed);
+        while (value < min && !m_min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {
+        }
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t n() const { return m_n.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    // upper edge of the bucket holding the q-quantile, 0 <= q <= 1
+    uint64_t quantile(double q) const;
+    const std::string& unit() const { return m_unit; }
+
+    void reset();
+    json to_json() const;
+
+  private:
+    std::string m_unit;
+    std::array<std::atomic<uint64_t>, n_buckets> m_buckets{};
+    std::atomic<uint64_t> m_n{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_min{UINT64_MAX};
+    std::atomic<uint64_t> m_max{0};
+};
+
+// the counter or histogram of that name, created on first use; the
+// returned references stay valid for the whole program
+Counter& counter(const std::string& name);
+Histogram& histogram(const std::string& name, const std::string& unit = "");
+
+// zero all metrics and restart the run clock
+void reset();
+
+// every metric, with the run time and the counters' rates
+json summary();
+
+// write summary() to a file
+void write_summary(const std::string& filename);
+
+// records the time between its construction and destruction, in ns
+class ScopedTimer {
+  public:
+    explicit ScopedTimer(Histogram& histogram)
+        : m_histogram(histogram), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        m_histogram.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - m_start)
+                            .count());
+    }
+
+  private:
+    Histogram& m_histogram;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+};  // namespace metrics
+
+};  // namespace rd53b
+
+#if defined(ITKPIX_INSTRUMENTATION)
+#define RD53B_METRICS_COUNT(name, n)                                           \
+    do {                                                                       \
+        static rd53b::metrics::Counter& rd53b_metric = rd53b::metrics::counter(name); \
+        rd53b_metric.add(n);                                                   \
+    } while (0)
+#define RD53B_METRICS_RECORD(name, unit, value)                                \
+    do {                                                                       \
+        static rd53b::metrics::Histogram& rd53b_metric =                       \
+            rd53b::metrics::histogram(name, unit);                             \
+        rd53b_metric.add(value);                                               \
+    } while (0)
+// time the rest of the enclosing scope
+#define RD53B_METRICS_TIMER(var, name)                                         \
+    rd53b::metrics::ScopedTimer var([]() -> rd53b::metrics::Histogram& {       \
+        static rd53b::metrics::Histogram& rd53b_metric =                       \
+            rd53b::metrics::histogram(name, "ns");                             \
+        return rd53b_metric;                                                   \
+    }())
+#else
+#define RD53B_METRICS_COUNT(name, n) \
+    do {                             \
+    } while (0)
+#define RD53B_METRICS_RECORD(name, unit, value) \
+    do {                                        \
+    } while (0)
+#define RD53B_METRICS_TIMER(var, name) \
+    do {                               \
+    } while (0)
+#endif
+
+#endif
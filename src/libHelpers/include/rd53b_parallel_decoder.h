@@ -0,0 +1,109 @@
+#ifndef RD53B_PARALLEL_DECODER_H
+#define RD53B_PARALLEL_DECODER_H
+
+// std/stl
+#include <array>
+#include <atomic>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>  // unique_ptr
+#include <mutex>
+#include <vector>
+
+// itkpix_dataflow
+#include "rd53b_decoder.h"
+#include "rd53b_event_buffer.h"
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Decodes a whole capture on several threads.
+//
+// Streams decode independently, so the capture is split into streams
+// (build_streams, keeping the last one of each channel) and the streams of
+// each channel are grouped into chunks of consecutive streams of roughly
+// equal size. Each thread starts with a contiguous share of the chunks in
+// its own queue, decodes them from the front into a buffer per chunk and,
+// once its queue is empty, steals chunks from the back of the other
+// threads' queues.
+//
+// The chunks of each channel are then appended in capture order, so
+// events(ch_id) holds the events of that channel in the order they were
+// sent, i.e. in the order of their (rolling over) tags, exactly as a
+// sequential decode would give them. An exception raised while decoding
+// stops all threads and is rethrown by decode(), unless the decoder is
+// "resilient": corrupted streams are then dropped and counted in
+// errors(ch_id), as with the error-resilient decode_stream.
+//
+class ParallelDecoder {
+  public:
+    static constexpr unsigned n_channels = 4;
+
+    // n_threads = 0: one per hardware thread
+    explicit ParallelDecoder(unsigned n_threads = 0, bool drop_tot = false,
+                             bool do_compressed_hitmap = false,
+                             bool use_ptot = false, bool resilient = false);
+
+    // decode the streams of the channels set in channel_mask, replacing
+    // the events of the previous call
+    void decode(BlockSpan blocks, uint8_t channel_mask = 0xf);
+
+    const EventBuffer& events(unsigned ch_id) const { return m_events[ch_id]; }
+    size_t n_blocks(unsigned ch_id) const { return m_n_blocks[ch_id]; }
+    size_t n_streams(unsigned ch_id) const { return m_n_streams[ch_id]; }
+    const DecodeErrors& errors(unsigned ch_id) const { return m_errors[ch_id]; }
+
+    unsigned n_threads() const { return m_n_threads; }
+    size_t n_chunks() const { return m_chunks.size(); }
+    // chunks decoded by another thread than the one they were given to
+    size_t n_steals() const { return m_n_steals.load(std::memory_order_relaxed); }
+
+  private:
+    struct Chunk {
+        uint8_t chip_id = 0;
+        size_t first_stream = 0;
+        size_t n_streams = 0;
+        EventBuffer events;
+        DecodeErrors errors;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<size_t> chunks;
+    };
+
+    void make_chunks(size_t n_blocks_total);
+    bool next_chunk(unsigned ithread, size_t& ichunk);
+    void work(unsigned ithread);
+
+    unsigned m_n_threads;
+    bool m_drop_tot;
+    bool m_do_compressed_hitmap;
+    bool m_use_ptot;
+    bool m_resilient;
+
+    std::vector<uint64_t> m_storage;
+    std::array<std::vector<Stream>, n_channels> m_streams;
+    std::vector<Chunk> m_chunks;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+
+    std::atomic<bool> m_abort{false};
+    std::atomic<size_t> m_n_steals{0};
+    std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+
+    std::array<EventBuffer, n_channels> m_events;
+    std::array<size_t, n_channels> m_n_blocks = {0, 0, 0, 0};
+    std::array<size_t, n_channels> m_n_streams = {0, 0, 0, 0};
+    std::array<DecodeErrors, n_channels> m_errors;
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
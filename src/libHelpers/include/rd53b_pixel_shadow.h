@@ -0,0 +1,92 @@
+#ifndef RD53B_PIXEL_SHADOW_H
+#define RD53B_PIXEL_SHADOW_H
+
+// std/stl
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <memory>  // unique_ptr
+#include <utility>  // pair
+#include <vector>
+
+// yarr
+#include "Rd53b.h"
+#include "SpecController.h"
+
+namespace rd53b {
+
+namespace command {
+
+//
+// The enable, injection enable and hitbus bits of one chip's pixel matrix,
+// for a differential pixel upload.
+//
+// The wanted bits are kept as packed bitsets (a bit per pixel, row-major),
+// so that bulk operations (fill, fill_columns) are a few word operations,
+// next to the bits the chip is known to hold. upload() compares the two
+// and only writes the pixel registers, i.e. the pixel pairs of a double
+// column in one row, that differ: the Rd53b pixel configuration of those
+// pixels is updated and they are sent with Rd53b::configurePixels(pixels).
+// When most registers differ, or the chip content is unknown, the whole
+// matrix is written with configurePixels() instead.
+//
+// Only these three bits are tracked: a change of TDAC through the Rd53b
+// configuration has to be uploaded with configurePixels(), after which
+// set_uploaded() puts the shadow back in sync.
+//
+class PixelShadow {
+  public:
+    static constexpr unsigned n_col = Rd53b::n_Col;
+    static constexpr unsigned n_row = Rd53b::n_Row;
+    static constexpr unsigned n_pixels = n_col * n_row;
+    static constexpr unsigned n_registers = n_pixels / 2;
+
+    // starts from the pixel configuration of fe; "uploaded": the chip
+    // already holds it (e.g. right after configurePixels)
+    explicit PixelShadow(Rd53b& fe, bool uploaded = false);
+
+    void set(unsigned col, unsigned row, bool enable, bool inject, bool hitbus);
+    // all pixels
+    void fill(bool enable, bool inject, bool hitbus);
+    // the pixels of columns [col_begin, col_end)
+    void fill_columns(unsigned col_begin, unsigned col_end, bool enable,
+                      bool inject, bool hitbus);
+
+    bool enable(unsigned col, unsigned row) const { return test(m_bits[0], index(col, row)); }
+    bool inject(unsigned col, unsigned row) const { return test(m_bits[1], index(col, row)); }
+    bool hitbus(unsigned col, unsigned row) const { return test(m_bits[2], index(col, row)); }
+
+    // pixel registers that differ from what the chip holds
+    size_t n_dirty() const;
+    // write the pixel registers that differ to the chip and wait for them
+    // to be sent; returns how many were written
+    size_t upload(std::unique_ptr<SpecController>& hw, Rd53b& fe);
+
+    // the chip content is unknown (e.g. after a reset): the next upload
+    // writes the whole matrix
+    void invalidate() { m_known = false; }
+    // the chip holds the configuration of fe (after configurePixels)
+    void set_uploaded(Rd53b& fe);
+
+  private:
+    using Bitset = std::vector<uint64_t>;
+    static constexpr size_t n_words = (n_pixels + 63) / 64;
+
+    static size_t index(unsigned col, unsigned row) { return size_t(row) * n_col + col; }
+    static bool test(const Bitset& bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 0x1; }
+    static void assign(Bitset& bits, size_t i, bool value);
+    // set bits [begin, end) to value
+    static void assign_range(Bitset& bits, size_t begin, size_t end, bool value);
+    void load(Rd53b& fe);
+
+    // enable, inject, hitbus
+    std::array<Bitset, 3> m_bits;
+    std::array<Bitset, 3> m_uploaded;
+    bool m_known = false;
+};
+
+};  // namespace command
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef RD53B_RATE_MONITOR_H
+#define RD53B_RATE_MONITOR_H
+
+// std/stl
+#include <chrono>
+#include <cstdint>
+
+// json
+#include "storage.hpp"
+
+namespace rd53b {
+
+namespace readout {
+
+//
+// What the acquisition has delivered so far, as counted by the consumer.
+//
+struct RateCounts {
+    uint64_t n_words = 0;      // 32-bit words read from the DMA
+    // event tags received, including those of streams without hits: one
+    // per trigger the chip answered
+    uint64_t n_tags = 0;
+    uint64_t n_events = 0;     // decoded events (with hits)
+    uint64_t n_hits = 0;       // decoded hits
+    uint64_t n_errors = 0;     // corrupted streams
+    uint64_t n_ring_full = 0;  // times the readout waited on the consumer
+};
+
+//
+// Rates over an interval, against the triggers expected from the trigger
+// configuration (the firmware has no trigger counter to read back, so the
+// trigger rate is the configured one, not a measured one).
+//
+struct RateSample {
+    double elapsed_s = 0;   // since start()
+    double interval_s = 0;  // covered by the rates
+    double configured_trigger_rate = 0;
+    double tag_rate = 0;
+    double event_rate = 0;
+    double hit_rate = 0;
+    double word_rate = 0;
+    // tags received over configured triggers: below 1 when triggers are
+    // lost (hitless triggers still send their tag)
+    double efficiency = 0;
+    // corrupted streams, or the readout falling behind the consumer
+    bool data_loss = false;
+    RateCounts counts;  // totals since start()
+
+    json to_json() const;
+};
+
+//
+// Live rate readback of a free-running acquisition: the consumer loop
+// calls update() with its running totals, and gets a sample of the rates
+// once per interval. The highest configured trigger rate of an interval
+// without data loss, with at least "min_efficiency" of the expected tags,
+// is the highest sustained one.
+//
+class RateMonitor {
+  public:
+    // "trigger_frequency": trigger pulses per second, each sending
+    // "triggers_per_pulse" triggers (the trigger multiplier)
+    RateMonitor(double trigger_frequency, unsigned triggers_per_pulse,
+                std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+                double min_efficiency = 0.99);
+
+    // at trigger enable
+    void start();
+    // true, with the sample in last(), when an interval has elapsed
+    bool update(const RateCounts& counts);
+    // the rates over the whole run, up to now
+    RateSample total(const RateCounts& counts) const;
+
+    const RateSample& last() const { return m_last; }
+    unsigned n_samples() const { return m_n_samples; }
+    unsigned n_lossy_samples() const { return m_n_lossy_samples; }
+    // 0 if no interval was free of data loss
+    double max_sustained_rate() const { return m_max_sustained_rate; }
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    RateSample sample(const RateCounts& begin, const RateCounts& end,
+                      clock::time_point t_begin, clock::time_point t_end) const;
+
+    double m_configured_trigger_rate;
+    std::chrono::milliseconds m_interval;
+    double m_min_efficiency;
+
+    clock::time_point m_start;
+    clock::time_point m_last_time;
+    RateCounts m_last_counts;
+    RateSample m_last;
+    unsigned m_n_samples = 0;
+    unsigned m_n_lossy_samples = 0;
+    double m_max_sustained_rate = 0;
+};
+
+};  // namespace readout
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef RD53B_READOUT_H
+#define RD53B_READOUT_H
+
+// std/stl
+#include <atomic>
+#include <cstddef>  // size_t
+#include <exception>
+#include <memory>  // unique_ptr
+#include <thread>
+
+// yarr
+#include "RawData.h"
+#include "SpecController.h"
+
+// itkpix_dataflow
+#include "spsc_ring.h"
+
+namespace rd53b {
+
+namespace readout {
+
+//
+// Drains the SPEC DMA buffer on a dedicated thread.
+//
+// Once started, the thread calls readData() back to back and moves every
+// RawData buffer it gets, as is, into a preallocated ring, until the
+// trigger logic reports that it is done. It then waits the controller's
+// wait time and drains whatever is left. The buffers are handed to the
+// consumer with next(), so that decoding and bookkeeping never delay the
+// DMA readout.
+//
+// The ring never drops data while the readout runs: if it is full the drain
+// thread waits for the consumer, which is counted in n_ring_full(). Only
+// stop() gives up on a consumer that no longer reads (e.g. one unwinding
+// from an exception): the buffer waiting for a slot is then dropped, and
+// counted in n_dropped().
+//
+class ReadoutThread {
+  public:
+    explicit ReadoutThread(std::unique_ptr<SpecController>& hw,
+                           size_t ring_capacity = 4096);
+    ~ReadoutThread();
+    ReadoutThread(const ReadoutThread&) = delete;
+    ReadoutThread& operator=(const ReadoutThread&) = delete;
+
+    void start();
+
+    // ask the drain thread to stop without waiting for the triggers to be
+    // done, and wait for it to exit; what is left in the DMA buffer is not
+    // read
+    void stop();
+
+    // same, without waiting: the drain thread still drains what is left,
+    // which the consumer keeps reading with next() until it returns false
+    // (for a consumer ending a free-running acquisition, which must not
+    // block while the drain thread may be waiting on a full ring)
+    void request_stop() { m_stop_requested = true; }
+
+    // the next buffer, blocking until one is available; returns false once
+    // the readout is finished and every buffer has been consumed
+    // (rethrows any exception raised on the drain thread)
+    bool next(std::unique_ptr<RawData>& data);
+
+    // non-blocking version of next(): false when no buffer is available
+    bool try_next(std::unique_ptr<RawData>& data);
+
+    bool finished() const { return m_finished.load(std::memory_order_acquire); }
+
+    size_t n_buffers() const { return m_n_buffers.load(std::memory_order_relaxed); }
+    size_t n_words() const { return m_n_words.load(std::memory_order_relaxed); }
+    size_t n_ring_full() const { return m_n_ring_full.load(std::memory_order_relaxed); }
+    size_t max_ring_depth() const { return m_max_ring_depth.load(std::memory_order_relaxed); }
+    size_t n_dropped() const { return m_n_dropped.load(std::memory_order_relaxed); }
+
+  private:
+    void run();
+    size_t drain();
+
+    std::unique_ptr<SpecController>& m_hw;
+    SpscRing<std::unique_ptr<RawData>> m_ring;
+    std::thread m_thread;
+    std::exception_ptr m_error;
+
+    std::atomic<bool> m_stop{false};
+    std::atomic<bool> m_stop_requested{false};
+    std::atomic<bool> m_finished{false};
+    std::atomic<size_t> m_n_buffers{0};
+    std::atomic<size_t> m_n_words{0};
+    std::atomic<size_t> m_n_ring_full{0};
+    std::atomic<size_t> m_max_ring_depth{0};
+    std::atomic<size_t> m_n_dropped{0};
+};
+
+};  // namespace readout
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef RD53B_REGISTER_SHADOW_H
+#define RD53B_REGISTER_SHADOW_H
+
+// std/stl
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+
+// yarr
+#include "Rd53b.h"
+
+namespace rd53b {
+
+namespace command {
+
+//
+// What one chip's global registers hold: the value last written to each of
+// them, for a differential configuration (rd53b::helpers::configure_diff)
+// that only sends the registers whose value in the Rd53b configuration
+// differs.
+//
+// A register is unknown until written through the shadow. Anything that
+// resets the chip (rd53b_reset, configure_init, a power cycle) makes the
+// whole shadow unknown again: call invalidate(), so that the next
+// configure_diff writes every register. Every other register write must go
+// through the shadow too (e.g. CommandBatch::write_register with it): a
+// write that bypasses it can leave the chip holding a value the shadow
+// does not know of, and configure_diff then skips a register that does
+// need writing.
+//
+class GlobalShadow {
+  public:
+    static constexpr unsigned n_registers = Rd53bGlobalCfg::numRegs;
+
+    GlobalShadow() { invalidate(); }
+
+    void invalidate() { m_known.fill(false); }
+    // the chip holds "value" at "address"
+    void record(uint32_t address, uint16_t value) {
+        m_value[address] = value;
+        m_known[address] = true;
+    }
+    // false if the chip may not hold "value" at "address"
+    bool holds(uint32_t address, uint16_t value) const {
+        return m_known[address] && m_value[address] == value;
+    }
+
+    bool known(uint32_t address) const { return m_known[address]; }
+    uint16_t value(uint32_t address) const { return m_value[address]; }
+    // registers of fe whose value the chip may not hold
+    size_t n_dirty(const Rd53b& fe) const;
+
+  private:
+    std::array<uint16_t, n_registers> m_value;
+    std::array<bool, n_registers> m_known;
+};
+
+};  // namespace command
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef RD53B_RUN_FILE_H
+#define RD53B_RUN_FILE_H
+
+// std/stl
+#include <array>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// json
+#include "storage.hpp"
+
+// itkpix_dataflow
+#include "rd53b_decoder.h"
+
+namespace rd53b {
+
+namespace io {
+
+//
+// Binary run files: the raw 64-bit Aurora blocks of a run, as received,
+// behind a header that records how the chips were set up so that the run
+// can be decoded offline.
+//
+// Layout (host byte order):
+//   0   char[8]   magic "RD53BRUN"
+//   8   uint32_t  format version
+//   12  uint32_t  offset of the first block (multiple of 8)
+//   16  uint8_t   chip_ids[4], the chip id on each channel (0xff = none)
+//   20  uint8_t   flags (see RunHeader)
+//   24  uint32_t  length of the trigger config
+//   28  char[]    trigger config, as JSON text
+//   ... zero padding up to the first block, then the blocks
+//
+// The number of blocks is not stored, it follows from the file size, so a
+// run that is cut short still leaves a readable file.
+//
+struct RunHeader {
+    static const uint32_t version = 1;
+    static const uint8_t no_chip = 0xff;
+
+    std::array<uint8_t, 4> chip_ids = {no_chip, no_chip, no_chip, no_chip};
+    bool compressed_hitmap = false;  // DataEnRaw = 0
+    bool drop_tot = false;           // DataEnBinaryRo = 1
+    bool use_ptot = false;           // PToT/PToA readout
+    json trigger_config;
+
+    // bit i set if a chip is read out on channel i
+    uint8_t channel_mask() const;
+};
+
+class RunFileWriter {
+  public:
+    RunFileWriter(const std::string& filename, const RunHeader& header);
+    ~RunFileWriter();
+    RunFileWriter(const RunFileWriter&) = delete;
+    RunFileWriter& operator=(const RunFileWriter&) = delete;
+
+    void write_blocks(const uint64_t* blocks, size_t n_blocks);
+
+    // 32-bit words as read out of the controller, a block may be split
+    // across two calls
+    void write_words(const uint32_t* words, size_t n_words);
+
+    void close();
+
+    size_t n_blocks() const { return m_n_blocks; }
+
+  private:
+    std::ofstream m_out;
+    std::string m_filename;
+    size_t m_n_blocks = 0;
+    uint32_t m_pending_word = 0;
+    bool m_has_pending_word = false;
+};
+
+//
+// Memory-mapped, read-only view of a run file: the blocks are used in
+// place and paged in by the kernel as they are read.
+//
+class RunFileReader {
+  public:
+    explicit RunFileReader(const std::string& filename);
+    ~RunFileReader();
+    RunFileReader(const RunFileReader&) = delete;
+    RunFileReader& operator=(const RunFileReader&) = delete;
+
+    const RunHeader& header() const { return m_header; }
+    rd53b::decoder::BlockSpan blocks() const { return m_blocks; }
+
+  private:
+    RunHeader m_header;
+    void* m_map = nullptr;
+    size_t m_map_size = 0;
+    rd53b::decoder::BlockSpan m_blocks;
+};
+
+};  // namespace io
+
+};  // namespace rd53b
+
+#endif
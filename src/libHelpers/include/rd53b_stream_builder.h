@@ -0,0 +1,64 @@
+#ifndef RD53B_STREAM_BUILDER_H
+#define RD53B_STREAM_BUILDER_H
+
+// std/stl
+#include <cstddef>  // size_t
+#include <cstdint>
+
+// itkpix_dataflow
+#include "rd53b_channel_demux.h"
+#include "rd53b_decoder.h"
+
+namespace rd53b {
+
+namespace decoder {
+
+//
+// Incremental version of build_streams, for decoding while acquiring.
+//
+// The 32-bit words read from the controller are pushed as they arrive
+// (in any chunking, a block may be split across two pushes) and paired
+// into 64-bit blocks, which are split by channel (2 LS bits of the chip
+// id) by a ChannelDemux: as soon as the next NS = 1 block of a channel
+// arrives the stream accumulated so far is handed to the callback and the
+// channel buffer is reused. Memory therefore stays bounded by the longest
+// stream, however long the run is.
+//
+// The Stream passed to the callback views the channel buffer and is only
+// valid for the duration of the call.
+//
+class StreamBuilder {
+  public:
+    using Callback = ChannelDemux::Callback;
+
+    explicit StreamBuilder(Callback on_stream, uint8_t channel_mask = 0xf);
+    StreamBuilder(const StreamBuilder&) = delete;
+    StreamBuilder& operator=(const StreamBuilder&) = delete;
+
+    void push(const uint32_t* words, size_t n_words);
+    void push_block(uint64_t block) { m_demux.push(block); }
+
+    // end of run: hand over the trailing stream of each channel, which no
+    // further NS = 1 block will close
+    void flush() { m_demux.flush(); }
+
+    // drop all partial state (streams in progress and an unpaired word)
+    void reset();
+
+    size_t n_blocks() const { return m_demux.n_blocks(); }
+    size_t n_streams() const { return m_demux.n_streams(); }
+    // blocks received on a channel before its first NS = 1 block
+    size_t n_orphan_blocks() const { return m_demux.n_orphan_blocks(); }
+    const ChannelDemux& demux() const { return m_demux; }
+
+  private:
+    ChannelDemux m_demux;
+    uint32_t m_pending_word = 0;
+    bool m_has_pending_word = false;
+};
+
+};  // namespace decoder
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef RD53B_TRIGGER_H
+#define RD53B_TRIGGER_H
+
+// std/stl
+#include <array>
+#include <chrono>
+#include <cstddef>  // size_t
+#include <cstdint>
+#include <memory>  // unique_ptr
+#include <vector>
+
+// json
+#include "storage.hpp"
+
+// yarr
+#include "SpecController.h"
+
+namespace rd53b {
+
+namespace trigger {
+
+//
+// The "trigger_config" block of the JSON configurations, parsed once.
+//
+// "mode" selects how the trigger logic stops: after "count" triggers
+// ("count", INT_COUNT, the default) or, free-running, after sending
+// triggers at "frequency" for "time" seconds ("time", INT_TIME).
+//
+struct TriggerConfig {
+    enum TRIG_CONF_VALUE mode = INT_COUNT;
+    uint32_t count = 0;
+    uint32_t delay = 56;
+    uint32_t multiplier = 16;
+    float frequency = 0;
+    float time = 0;
+    bool no_inject = false;
+    bool edge_mode = true;
+    bool ext_trigger = false;
+    uint32_t edge_duration = 2;
+
+    // throws json exceptions on missing fields, as before, and
+    // std::runtime_error on an unsupported mode or multiplier
+    static TriggerConfig from_json(const json& trigger_config);
+
+    bool timed() const { return mode == INT_TIME; }
+
+    bool operator==(const TriggerConfig& other) const;
+    bool operator!=(const TriggerConfig& other) const { return !(*this == other); }
+};
+
+// the sequence of commands the trigger logic sends for each trigger, as
+// 32-bit words in the order setTrigWord takes them
+using TriggerWords = std::array<uint32_t, 32>;
+
+// the trigger words of a configuration; only the delay, the multiplier and
+// the edge duration enter them, and they are encoded once per process for
+// each set of those (the returned reference stays valid)
+const TriggerWords& trigger_words(const TriggerConfig& config);
+
+// the tags of the events that one pulse of the trigger logic gives, in the
+// order the chip sends them: every bunch crossing of a trigger command's
+// pattern is one event, tagged with the command's tag and the position of
+// the bunch crossing (the words are sent from the last to the first, each
+// MS half first)
+std::vector<uint16_t> event_tags(const uint32_t* words, size_t n_words);
+std::vector<uint16_t> event_tags(const TriggerConfig& config);
+
+// how long to wait for the trigger logic to be done with a configuration:
+// its expected run time (count / frequency, or "time" in the free-running
+// mode) plus 10% and 10 s, and no less than wait::default_trigger_timeout;
+// wait::no_timeout with external triggers, or without a frequency, whose
+// run time is not known
+std::chrono::milliseconds done_timeout(const TriggerConfig& config);
+
+//
+// Programs the SPEC trigger logic, remembering what it was last programmed
+// with so that reloading a configuration (e.g. at every step of a scan)
+// only writes the settings that changed, or nothing.
+//
+// The controller keeps its trigger settings between runs. Anything else
+// programming the trigger logic makes the loader's record wrong: call
+// invalidate() so that the next load() writes everything.
+//
+class TriggerLoader {
+  public:
+    // returns the number of controller settings written
+    unsigned load(std::unique_ptr<SpecController>& hw, const TriggerConfig& config);
+    void invalidate() { m_hw = nullptr; }
+
+  private:
+    const SpecController* m_hw = nullptr;
+    TriggerConfig m_config;
+};
+
+//
+// Counts the triggers a chip did not answer, from the gaps in the sequence
+// of event tags it sent (those of the streams without hits included).
+//
+// Every pulse gives the same sequence of tags (event_tags). Each tag
+// received is matched with its next occurrence in that sequence: the tags
+// skipped on the way are missing. A whole pulse lost leaves no gap, so
+// finish() adds what is still missing from the number of pulses sent.
+// Tags are compared on their 8 LS bits, i.e. internal tags as stream tags.
+//
+class TagGaps {
+  public:
+    explicit TagGaps(std::vector<uint16_t> expected);
+
+    void push(uint16_t tag);
+    // after the last tag of a run of "n_pulses" pulses
+    void finish(uint64_t n_pulses);
+
+    uint64_t n_received() const { return m_n_received; }
+    uint64_t n_missing() const { return m_n_missing; }
+    // tags that are not in the sequence at all
+    uint64_t n_unexpected() const { return m_n_unexpected; }
+
+  private:
+    std::vector<uint16_t> m_expected;
+    size_t m_next = 0;  // position of the next expected tag
+    uint64_t m_n_received = 0;
+    uint64_t m_n_missing = 0;
+    uint64_t m_n_unexpected = 0;
+};
+
+};  // namespace trigger
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef RD53B_WAIT_H
+#define RD53B_WAIT_H
+
+// std/stl
+#include <algorithm>  // min
+#include <chrono>
+#include <cstdint>
+#include <memory>  // unique_ptr
+#include <thread>
+
+// yarr
+#include "SpecController.h"
+
+namespace rd53b {
+
+namespace wait {
+
+//
+// Waiting on the SPEC firmware without burning a core.
+//
+// Each poll of isCmdEmpty() or isTrigDone() is a register read over PCIe,
+// so instead of spinning on them the condition is polled with a backoff:
+// back to back for the first n_spin polls (the command FIFO usually drains
+// within a few), then yielding for n_yield polls, then sleeping between
+// polls, the sleep doubling from min_sleep up to max_sleep. The CPU is
+// then left to the readout and decoding threads, at the price of up to
+// max_sleep of extra latency on long waits.
+//
+struct Backoff {
+    unsigned n_spin = 16;
+    unsigned n_yield = 16;
+    std::chrono::microseconds min_sleep{10};
+    std::chrono::microseconds max_sleep{1000};
+};
+
+// the backoff of a loop polling for work rather than for one condition:
+// pause() after each poll that found nothing, reset() once one found some
+class IdleBackoff {
+  public:
+    explicit IdleBackoff(const Backoff& backoff = Backoff())
+        : m_backoff(backoff), m_sleep(backoff.min_sleep) {}
+
+    void reset() {
+        m_n_idle = 0;
+        m_sleep = m_backoff.min_sleep;
+    }
+    void pause() {
+        m_n_idle++;
+        if (m_n_idle <= m_backoff.n_spin) return;
+        if (m_n_idle <= m_backoff.n_spin + m_backoff.n_yield) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(m_sleep);
+            m_sleep = std::min(2 * m_sleep, m_backoff.max_sleep);
+        }
+    }
+
+  private:
+    Backoff m_backoff;
+    uint64_t m_n_idle = 0;
+    std::chrono::microseconds m_sleep;
+};
+
+struct Result {
+    bool done = false;  // false: timed out
+    uint64_t n_polls = 0;
+    std::chrono::nanoseconds elapsed{0};
+};
+
+// poll "done" until it returns true or "timeout" has elapsed
+template <typename Predicate>
+Result poll_until(Predicate&& done, std::chrono::nanoseconds timeout,
+                  const Backoff& backoff = Backoff()) {
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    IdleBackoff idle(backoff);
+    while (true) {
+        result.n_polls++;
+        if (done()) {
+            result.done = true;
+            break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - start >= timeout) break;
+        idle.pause();
+    }
+    result.elapsed = std::chrono::steady_clock::now() - start;
+    return result;
+}
+
+constexpr std::chrono::milliseconds default_cmd_timeout{1000};
+// the shortest wait for the trigger logic, see trigger::done_timeout
+constexpr std::chrono::milliseconds default_trigger_timeout{60000};
+// a timeout that never expires
+constexpr std::chrono::milliseconds no_timeout =
+    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::nanoseconds::max());
+
+// wait for the command FIFO to be sent out, returning the number of polls;
+// throws std::runtime_error on timeout (e.g. a hung TX link)
+uint64_t cmd_empty(std::unique_ptr<SpecController>& hw,
+                   std::chrono::milliseconds timeout = default_cmd_timeout);
+
+// wait for the trigger logic to be done, returning the number of polls;
+// throws std::runtime_error on timeout
+uint64_t trig_done(std::unique_ptr<SpecController>& hw,
+                   std::chrono::milliseconds timeout = default_trigger_timeout);
+
+};  // namespace wait
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+// std/stl
+#include <atomic>
+#include <cstddef>  // size_t
+#include <utility>  // move
+#include <vector>
+
+namespace rd53b {
+
+namespace readout {
+
+//
+// Bounded, lock-free ring buffer for exactly one producer thread and one
+// consumer thread. All slots are allocated up front, so pushing and
+// popping never allocates. The capacity is rounded up to a power of two.
+//
+template <typename T>
+class SpscRing {
+  public:
+    explicit SpscRing(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        m_slots.resize(n);
+        m_mask = n - 1;
+    }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer side, returns false (leaving "value" untouched) when full
+    bool try_push(T&& value) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache == m_slots.size()) {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache == m_slots.size()) return false;
+        }
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, returns false when empty
+    bool try_pop(T& value) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache) {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache) return false;
+        }
+        value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only exact when called from one of the two threads while the other
+    // is idle, otherwise a snapshot
+    size_t size() const {
+        return m_tail.load(std::memory_order_acquire) -
+               m_head.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return m_slots.size(); }
+
+  private:
+    std::vector<T> m_slots;
+    size_t m_mask = 0;
+
+    // each index, and the copy of the other index that its thread caches,
+    // on its own cache line
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_tail_cache = 0;
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_head_cache = 0;
+};
+
+};  // namespace readout
+
+};  // namespace rd53b
+
+#endif
@@ -0,0 +1,77 @@
+#include "rd53b_channel_demux.h"
+#include "rd53b_metrics.h"
+
+// std/stl
+#include <algorithm>  // max
+#include <utility>    // move
+
+rd53b::decoder::ChannelDemux::ChannelDemux(Callback on_stream,
+                                           uint8_t channel_mask,
+                                           size_t reserve_blocks)
+    : m_on_stream(std::move(on_stream)) {
+    for (unsigned ch_id = 0; ch_id < n_channels; ch_id++) {
+        Channel& channel = m_channels[ch_id];
+        channel.expected = (channel_mask >> ch_id) & 0x1;
+        if (channel.expected) {
+            channel.blocks.reserve(reserve_blocks);
+        }
+    }
+}
+
+void rd53b::decoder::ChannelDemux::flush() {
+    for (uint8_t ch_id = 0; ch_id < n_channels; ch_id++) {
+        if (m_channels[ch_id].in_stream) {
+            emit(ch_id);
+            m_channels[ch_id].in_stream = false;
+        }
+    }
+}
+
+void rd53b::decoder::ChannelDemux::reset() {
+    for (auto& channel : m_channels) {
+        channel.blocks.clear();
+        channel.in_stream = false;
+    }
+}
+
+size_t rd53b::decoder::ChannelDemux::n_blocks() const {
+    size_t n = 0;
+    for (const auto& channel : m_channels) n += channel.counters.n_blocks;
+    return n;
+}
+
+size_t rd53b::decoder::ChannelDemux::n_streams() const {
+    size_t n = 0;
+    for (const auto& channel : m_channels) n += channel.counters.n_streams;
+    return n;
+}
+
+size_t rd53b::decoder::ChannelDemux::n_orphan_blocks() const {
+    size_t n = 0;
+    for (const auto& channel : m_channels) n += channel.counters.n_orphan_blocks;
+    return n;
+}
+
+size_t rd53b::decoder::ChannelDemux::n_unexpected_blocks() const {
+    size_t n = 0;
+    for (const auto& channel : m_channels) {
+        if (!channel.expected) n += channel.counters.n_blocks;
+    }
+    return n;
+}
+
+void rd53b::decoder::ChannelDemux::emit(uint8_t ch_id) {
+    Channel& channel = m_channels[ch_id];
+    Stream stream;
+    stream.chip_id = ch_id;
+    stream.blocks.ptr = channel.blocks.data();
+    stream.blocks.len = channel.blocks.size();
+    channel.counters.n_streams++;
+    channel.counters.max_stream_blocks =
+        std::max(channel.counters.max_stream_blocks, channel.blocks.size());
+    RD53B_METRICS_COUNT("demux.streams", 1);
+    RD53B_METRICS_COUNT("demux.blocks", channel.blocks.size());
+    RD53B_METRICS_RECORD("demux.stream_blocks", "blocks", channel.blocks.size());
+    m_on_stream(stream);
+    channel.blocks.clear();
+}
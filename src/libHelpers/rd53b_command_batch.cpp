@@ -0,0 +1,113 @@
+#include "rd53b_command_batch.h"
+#include "rd53b_metrics.h"
+#include "rd53b_wait.h"
+
+// std/stl
+#include <algorithm>  // min
+#include <thread>
+
+namespace {
+// the values of the global registers are kept in a protected array of
+// Rd53b: reach it through a derived class, without ever making one
+struct GlobalRegisters : Rd53b {
+    static uint16_t word(const Rd53b& fe, uint32_t address) {
+        return (fe.*(&GlobalRegisters::m_cfg))[address];
+    }
+    static void set_word(Rd53b& fe, uint32_t address, uint16_t value) {
+        (fe.*(&GlobalRegisters::m_cfg))[address] = value;
+    }
+};
+};  // namespace
+
+uint16_t rd53b::command::register_word(const Rd53b& fe, uint32_t address) {
+    return GlobalRegisters::word(fe, address);
+}
+
+void rd53b::command::set_register_word(Rd53b& fe, uint32_t address, uint16_t value) {
+    GlobalRegisters::set_word(fe, address, value);
+}
+
+rd53b::command::CommandBatch::CommandBatch(size_t max_burst_words)
+    : m_max_burst_words(std::max<size_t>(2, max_burst_words & ~size_t(1))) {}
+
+void rd53b::command::CommandBatch::write_named_register(Rd53b& fe,
+                                                        const std::string& name,
+                                                        uint16_t value,
+                                                        GlobalShadow* shadow) {
+    auto it = fe.regMap.find(name);
+    if (it != fe.regMap.end()) {
+        write_register(fe, it->second, value, shadow);
+        return;
+    }
+    m_waits.push_back({m_words.size(), std::chrono::microseconds(0),
+                       [&fe, name, value, shadow]() {
+                           if (!shadow) {
+                               fe.writeNamedRegister(name, value);
+                               return;
+                           }
+                           // which registers it writes is only known to
+                           // Rd53b: record those it changes
+                           std::array<uint16_t, GlobalShadow::n_registers> before;
+                           for (uint32_t address = 0; address < before.size(); address++) {
+                               before[address] = register_word(fe, address);
+                           }
+                           fe.writeNamedRegister(name, value);
+                           for (uint32_t address = 0; address < before.size(); address++) {
+                               uint16_t word = register_word(fe, address);
+                               if (word != before[address]) shadow->record(address, word);
+                           }
+                       }});
+}
+
+void rd53b::command::CommandBatch::wait(std::chrono::microseconds duration) {
+    if (!m_waits.empty() && m_waits.back().word == m_words.size() &&
+        !m_waits.back().action) {
+        m_waits.back().duration += duration;
+        return;
+    }
+    m_waits.push_back({m_words.size(), duration});
+}
+
+void rd53b::command::CommandBatch::write_words(std::unique_ptr<SpecController>& hw,
+                                               size_t begin, size_t end) {
+    while (begin < end) {
+        size_t burst_end = std::min(end, begin + m_max_burst_words);
+        size_t i = begin;
+        for (; i + 1 < burst_end; i += 2) {
+            hw->writeFifo((static_cast<uint32_t>(m_words[i]) << 16) | m_words[i + 1]);
+        }
+        if (i < burst_end) {
+            hw->writeFifo((static_cast<uint32_t>(m_words[i]) << 16) | noop_word);
+        }
+        hw->releaseFifo();
+        RD53B_METRICS_COUNT("command_batch.fifo_words", (burst_end - begin + 1) / 2);
+        begin = burst_end;
+        if (begin < end) {
+            rd53b::wait::cmd_empty(hw);
+        }
+    }
+}
+
+void rd53b::command::CommandBatch::send(std::unique_ptr<SpecController>& hw) {
+    RD53B_METRICS_TIMER(timer, "command_batch.send_ns");
+    size_t begin = 0;
+    for (const auto& wait_point : m_waits) {
+        write_words(hw, begin, wait_point.word);
+        begin = wait_point.word;
+        rd53b::wait::cmd_empty(hw);
+        if (wait_point.duration.count() > 0) {
+            std::this_thread::sleep_for(wait_point.duration);
+        }
+        if (wait_point.action) {
+            wait_point.action();
+            hw->releaseFifo();
+        }
+    }
+    write_words(hw, begin, m_words.size());
+    reset();
+}
+
+void rd53b::command::CommandBatch::reset() {
+    m_words.clear();
+    m_waits.clear();
+}
@@ -0,0 +1,306 @@
+#include "rd53b_config_cache.h"
+#include "rd53b_command_batch.h"  // register_word, set_register_word
+#include "rd53b_metrics.h"
+
+// json
+#include "storage.hpp"
+
+// std/stl
+#include <cerrno>
+#include <cstdlib>  // getenv
+#include <cstring>  // memcmp, memcpy, strerror
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+namespace fs = std::experimental::filesystem;
+
+// posix
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char cache_file_magic[8] = {'R', 'D', '5', '3', 'B', 'C', 'F', 'G'};
+const size_t fixed_header_size = 40;
+const uint32_t flag_parse_json = 0x1;
+
+const unsigned n_col = Rd53b::n_Col;
+const unsigned n_row = Rd53b::n_Row;
+const size_t n_pixels = n_col * n_row;
+const size_t n_bitset_words = (n_pixels + 63) / 64;
+const uint32_t n_registers = Rd53bGlobalCfg::numRegs;
+
+size_t pixel_offset(uint32_t name_len, uint32_t parameters_len) {
+    return (fixed_header_size + n_registers * sizeof(uint16_t) + name_len + parameters_len +
+            7) / 8 * 8;
+}
+
+size_t file_size(uint32_t name_len, uint32_t parameters_len) {
+    return pixel_offset(name_len, parameters_len) + 3 * n_bitset_words * sizeof(uint64_t) +
+           n_pixels;
+}
+
+// the header of an entry, without the chip id, name and parameters
+std::vector<char> header(uint64_t hash, uint32_t flags) {
+    std::vector<char> buf(fixed_header_size, 0);
+    uint32_t file_version = rd53b::io::ChipConfigCache::version;
+    uint32_t file_n_registers = n_registers;
+    std::memcpy(&buf[0], cache_file_magic, sizeof(cache_file_magic));
+    std::memcpy(&buf[8], &file_version, sizeof(file_version));
+    std::memcpy(&buf[16], &hash, sizeof(hash));
+    std::memcpy(&buf[24], &file_n_registers, sizeof(file_n_registers));
+    std::memcpy(&buf[36], &flags, sizeof(flags));
+    return buf;
+}
+
+std::string system_error(const std::string& what, const std::string& filename) {
+    return what + " \"" + filename + "\": " + std::strerror(errno);
+}
+
+void write_file(const std::string& path, const std::vector<char>& buf) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(buf.data(), buf.size());
+    out.close();
+    if (!out) {
+        throw std::runtime_error(system_error("Unable to write", path));
+    }
+}
+};  // namespace
+
+rd53b::io::ChipConfigCache::ChipConfigCache(std::string directory)
+    : m_directory(std::move(directory)) {}
+
+std::string rd53b::io::ChipConfigCache::default_directory() {
+    if (const char* dir = std::getenv("ITKPIX_CONFIG_CACHE")) return dir;
+    if (const char* dir = std::getenv("XDG_CACHE_HOME")) {
+        if (dir[0] != '\0') return std::string(dir) + "/itkpix_dataflow";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        if (home[0] != '\0') return std::string(home) + "/.cache/itkpix_dataflow";
+    }
+    return "";
+}
+
+uint64_t rd53b::io::ChipConfigCache::hash(const char* data, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= static_cast<uint8_t>(data[i]);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+std::string rd53b::io::ChipConfigCache::path(uint64_t hash) const {
+    std::stringstream name;
+    name << std::hex;
+    name.width(16);
+    name.fill('0');
+    name << hash;
+    return m_directory + "/" + name.str() + ".rd53bcfg";
+}
+
+bool rd53b::io::ChipConfigCache::load(const std::string& filename, Rd53b& fe) {
+    RD53B_METRICS_TIMER(timer, "config_cache.load_ns");
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error(system_error("Unable to open chip configuration", filename));
+    }
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    uint64_t h = hash(text.data(), text.size());
+    Lookup lookup = enabled() ? read(path(h), h, fe) : Lookup::miss;
+    if (lookup == Lookup::hit) {
+        RD53B_METRICS_COUNT("config_cache.hits", 1);
+        return true;
+    }
+
+    json config = json::parse(text);
+    fe.fromFileJson(config);
+    RD53B_METRICS_COUNT("config_cache.misses", 1);
+    if (enabled() && lookup == Lookup::miss) {
+        // a cache that can not be written only costs the next start-up
+        try {
+            write(path(h), h, fe, config);
+        } catch (std::exception& e) {
+            std::cout << "WARNING: unable to cache the chip configuration: " << e.what()
+                      << std::endl;
+        }
+    }
+    return false;
+}
+
+rd53b::io::ChipConfigCache::Lookup rd53b::io::ChipConfigCache::read(
+    const std::string& path, uint64_t hash, Rd53b& fe) const {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return Lookup::miss;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < fixed_header_size) {
+        ::close(fd);
+        return Lookup::miss;
+    }
+    size_t map_size = st.st_size;
+    void* map = ::mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return Lookup::miss;
+
+    // anything unexpected is a miss: the JSON is parsed and the entry
+    // rewritten
+    auto bytes = static_cast<const char*>(map);
+    uint32_t file_version = 0;
+    uint32_t chip_id = 0;
+    uint64_t file_hash = 0;
+    uint32_t file_n_registers = 0;
+    uint32_t name_len = 0;
+    uint32_t parameters_len = 0;
+    uint32_t flags = 0;
+    std::memcpy(&file_version, &bytes[8], sizeof(file_version));
+    std::memcpy(&chip_id, &bytes[12], sizeof(chip_id));
+    std::memcpy(&file_hash, &bytes[16], sizeof(file_hash));
+    std::memcpy(&file_n_registers, &bytes[24], sizeof(file_n_registers));
+    std::memcpy(&name_len, &bytes[28], sizeof(name_len));
+    std::memcpy(&parameters_len, &bytes[32], sizeof(parameters_len));
+    std::memcpy(&flags, &bytes[36], sizeof(flags));
+    if (std::memcmp(bytes, cache_file_magic, sizeof(cache_file_magic)) != 0 ||
+        file_version != version || file_hash != hash || file_n_registers != n_registers) {
+        ::munmap(map, map_size);
+        return Lookup::miss;
+    }
+    if (flags & flag_parse_json) {
+        ::munmap(map, map_size);
+        return map_size == fixed_header_size ? Lookup::parse_json : Lookup::miss;
+    }
+    if (name_len > map_size || parameters_len > map_size ||
+        map_size != file_size(name_len, parameters_len)) {
+        ::munmap(map, map_size);
+        return Lookup::miss;
+    }
+
+    try {
+        // the calibration constants first, YARR's way, so that the copied
+        // configuration below has the last word
+        const char* parameters = bytes + fixed_header_size + n_registers * sizeof(uint16_t) +
+                                 name_len;
+        if (parameters_len > 0) {
+            json partial;
+            partial["RD53B"]["Parameter"] = json::parse(parameters, parameters + parameters_len);
+            fe.fromFileJson(partial);
+        }
+    } catch (std::exception&) {
+        ::munmap(map, map_size);
+        return Lookup::miss;
+    }
+
+    fe.setChipId(chip_id);
+    const char* p = bytes + fixed_header_size;
+    for (uint32_t address = 0; address < n_registers; address++) {
+        uint16_t word;
+        std::memcpy(&word, p + address * sizeof(uint16_t), sizeof(word));
+        rd53b::command::set_register_word(fe, address, word);
+    }
+    p += n_registers * sizeof(uint16_t);
+    fe.setName(std::string(p, name_len));
+
+    // the mapping is page aligned and the bitsets start at a multiple of 8
+    auto bits =
+        reinterpret_cast<const uint64_t*>(bytes + pixel_offset(name_len, parameters_len));
+    const uint64_t* enable = bits;
+    const uint64_t* inject = bits + n_bitset_words;
+    const uint64_t* hitbus = bits + 2 * n_bitset_words;
+    auto tdac = reinterpret_cast<const int8_t*>(bits + 3 * n_bitset_words);
+    for (unsigned row = 0; row < n_row; row++) {
+        for (unsigned col = 0; col < n_col; col++) {
+            size_t i = size_t(row) * n_col + col;
+            fe.setEn(col, row, (enable[i / 64] >> (i % 64)) & 0x1);
+            fe.setInjEn(col, row, (inject[i / 64] >> (i % 64)) & 0x1);
+            fe.setHitbus(col, row, (hitbus[i / 64] >> (i % 64)) & 0x1);
+            fe.setTDAC(col, row, tdac[i]);
+        }
+    }
+    ::munmap(map, map_size);
+    return Lookup::hit;
+}
+
+void rd53b::io::ChipConfigCache::write(const std::string& path, uint64_t hash, Rd53b& fe,
+                                       const json& config) const {
+    std::string parameters;
+    auto chip_config = config.find("RD53B");
+    if (chip_config != config.end()) {
+        auto parameter_block = chip_config->find("Parameter");
+        if (parameter_block != chip_config->end()) parameters = parameter_block->dump();
+    }
+    std::string name = fe.getName();
+    uint32_t name_len = name.size();
+    uint32_t parameters_len = parameters.size();
+
+    std::vector<char> buf = header(hash, 0);
+    buf.resize(file_size(name_len, parameters_len), 0);
+    uint32_t chip_id = fe.getChipId();
+    std::memcpy(&buf[12], &chip_id, sizeof(chip_id));
+    std::memcpy(&buf[28], &name_len, sizeof(name_len));
+    std::memcpy(&buf[32], &parameters_len, sizeof(parameters_len));
+    char* p = &buf[fixed_header_size];
+    for (uint32_t address = 0; address < n_registers; address++) {
+        uint16_t word = rd53b::command::register_word(fe, address);
+        std::memcpy(p + address * sizeof(uint16_t), &word, sizeof(word));
+    }
+    p += n_registers * sizeof(uint16_t);
+    std::memcpy(p, name.data(), name_len);
+    p += name_len;
+    std::memcpy(p, parameters.data(), parameters_len);
+
+    std::vector<uint64_t> bits(3 * n_bitset_words, 0);
+    std::vector<int8_t> tdac(n_pixels);
+    for (unsigned row = 0; row < n_row; row++) {
+        for (unsigned col = 0; col < n_col; col++) {
+            size_t i = size_t(row) * n_col + col;
+            uint64_t mask = uint64_t(1) << (i % 64);
+            if (fe.getEn(col, row)) bits[i / 64] |= mask;
+            if (fe.getInjEn(col, row)) bits[n_bitset_words + i / 64] |= mask;
+            if (fe.getHitbus(col, row)) bits[2 * n_bitset_words + i / 64] |= mask;
+            tdac[i] = fe.getTDAC(col, row);
+        }
+    }
+    size_t offset = pixel_offset(name_len, parameters_len);
+    std::memcpy(&buf[offset], bits.data(), bits.size() * sizeof(uint64_t));
+    std::memcpy(&buf[offset + bits.size() * sizeof(uint64_t)], tdac.data(), tdac.size());
+
+    // written aside and renamed, so that a concurrent start-up never maps
+    // a partial file
+    fs::create_directories(m_directory);
+    std::string tmp_path = path + "." + std::to_string(::getpid()) + ".tmp";
+    try {
+        write_file(tmp_path, buf);
+
+        // a cached load must give what the JSON load gave: anything the
+        // entry misses, or that fromFileJson does not take from the
+        // "Parameter" block alone, makes it a parse-the-JSON entry
+        bool same = false;
+        try {
+            Rd53b cached;
+            if (read(tmp_path, hash, cached) == Lookup::hit) {
+                json from_json;
+                json from_cache;
+                fe.toFileJson(from_json);
+                cached.toFileJson(from_cache);
+                same = (from_json == from_cache);
+            }
+        } catch (std::exception&) {
+            same = false;
+        }
+        if (!same) {
+            RD53B_METRICS_COUNT("config_cache.uncacheable", 1);
+            write_file(tmp_path, header(hash, flag_parse_json));
+        }
+
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error(system_error("Unable to rename", tmp_path));
+        }
+    } catch (...) {
+        fs::remove(tmp_path);
+        throw;
+    }
+}
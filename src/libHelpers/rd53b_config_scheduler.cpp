@@ -0,0 +1,241 @@
+#include "rd53b_config_scheduler.h"
+#include "rd53b_command_batch.h"
+#include "rd53b_helpers.h"  // init_sequence
+#include "rd53b_metrics.h"
+#include "rd53b_wait.h"
+
+// std/stl
+#include <algorithm>  // sort
+#include <chrono>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+size_t rd53b::command::ConfigScheduler::add(Rd53b& fe, GlobalShadow& shadow) {
+    m_chips.push_back({&fe, &shadow, no_dependency, std::chrono::milliseconds(0), 0});
+    assign_rounds();
+    return m_chips.size() - 1;
+}
+
+void rd53b::command::ConfigScheduler::after(size_t chip, size_t dependency,
+                                            std::chrono::milliseconds delay) {
+    if (chip >= m_chips.size() || dependency >= chip) {
+        throw std::runtime_error("ConfigScheduler: a chip can only depend on a chip added before it");
+    }
+    m_chips[chip].dependency = dependency;
+    m_chips[chip].delay = delay;
+    assign_rounds();
+}
+
+size_t rd53b::command::ConfigScheduler::n_stages() const {
+    return m_rounds.empty() ? 0 : m_rounds.back().stage + 1;
+}
+
+void rd53b::command::ConfigScheduler::assign_rounds() {
+    // a chip is configured in the stage after the one of its dependency,
+    // which was added before it
+    size_t n_stages = 0;
+    for (auto& chip : m_chips) {
+        chip.stage = chip.dependency == no_dependency ? 0 : m_chips[chip.dependency].stage + 1;
+        n_stages = std::max(n_stages, chip.stage + 1);
+    }
+
+    m_rounds.clear();
+    for (size_t stage = 0; stage < n_stages; stage++) {
+        // the chip ids on each TX channel
+        std::map<uint32_t, std::vector<size_t>> channels;
+        for (size_t ichip = 0; ichip < m_chips.size(); ichip++) {
+            if (m_chips[ichip].stage != stage) continue;
+            channels[m_chips[ichip].fe->getTxChannel()].push_back(ichip);
+        }
+
+        // a TX channel goes to the first round of the stage where none of
+        // its chip ids is already used
+        size_t first_round = m_rounds.size();
+        std::vector<std::set<uint32_t>> round_ids;
+        for (const auto& channel : channels) {
+            std::set<uint32_t> ids;
+            for (size_t ichip : channel.second) ids.insert(m_chips[ichip].fe->getChipId());
+            size_t iround = 0;
+            for (; iround < round_ids.size(); iround++) {
+                bool clash = false;
+                for (uint32_t id : ids) clash = clash || round_ids[iround].count(id) > 0;
+                if (!clash) break;
+            }
+            if (iround == round_ids.size()) {
+                m_rounds.emplace_back();
+                m_rounds.back().stage = stage;
+                round_ids.emplace_back();
+            }
+            Round& round = m_rounds[first_round + iround];
+            round.tx_channels.push_back(channel.first);
+            round.chips.insert(round.chips.end(), channel.second.begin(), channel.second.end());
+            round_ids[iround].insert(ids.begin(), ids.end());
+        }
+    }
+    for (auto& round : m_rounds) std::sort(round.chips.begin(), round.chips.end());
+}
+
+void rd53b::command::ConfigScheduler::enable_all(std::unique_ptr<SpecController>& hw) const {
+    std::vector<uint32_t> channels;
+    for (const auto& round : m_rounds) {
+        channels.insert(channels.end(), round.tx_channels.begin(), round.tx_channels.end());
+    }
+    hw->setCmdEnable(channels);
+}
+
+void rd53b::command::ConfigScheduler::configure_init(std::unique_ptr<SpecController>& hw) {
+    for (size_t stage = 0; stage < n_stages(); stage++) configure_init(hw, stage);
+}
+
+void rd53b::command::ConfigScheduler::configure_init(std::unique_ptr<SpecController>& hw,
+                                                     size_t stage) {
+    std::vector<uint32_t> channels;
+    std::vector<size_t> chips;
+    for (const auto& round : m_rounds) {
+        if (round.stage != stage) continue;
+        channels.insert(channels.end(), round.tx_channels.begin(), round.tx_channels.end());
+        chips.insert(chips.end(), round.chips.begin(), round.chips.end());
+    }
+    if (chips.empty()) return;
+    hw->setCmdEnable(channels);
+
+    // Wait for at least 1000us before chip is release from reset
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Sync CMD decoder
+    for (unsigned int i = 0; i < 32; i++) hw->writeFifo(0x817E817E);
+    hw->releaseFifo();
+    rd53b::wait::cmd_empty(hw);
+
+    CommandBatch batch;
+    if (stage == 0) {
+        // the reset sequence is the same for all chips: send it once, to
+        // all; the broadcast configuration it is built from is thrown away
+        Rd53b broadcast;
+        broadcast.setChipId(broadcast_chip_id);
+        rd53b::helpers::init_sequence(batch, broadcast);
+    } else {
+        // as sent to each chip by the sequential configure_init
+        for (size_t ichip : chips) rd53b::helpers::init_sequence(batch, *m_chips[ichip].fe);
+    }
+    for (size_t ichip : chips) m_chips[ichip].shadow->invalidate();
+    batch.send(hw);
+    rd53b::wait::cmd_empty(hw);
+
+    // the sequence also sets the registers it writes in the configuration
+    // it is built from: do the same for each chip, as the sequential
+    // configure_init does, so that the global configuration that follows
+    // writes the same values (the commands are thrown away)
+    if (stage == 0) {
+        for (size_t ichip : chips) {
+            CommandBatch discarded;
+            rd53b::helpers::init_sequence(discarded, *m_chips[ichip].fe);
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+size_t rd53b::command::ConfigScheduler::configure_global(std::unique_ptr<SpecController>& hw,
+                                                         const Round& round) {
+    // same order and pacing as rd53b::helpers::configure_diff: a pause
+    // after the preamp bias (register 13), at most 20 writes per burst
+    CommandBatch batch(20 * 4);
+    size_t n_written = 0;
+    std::vector<uint16_t> values(round.chips.size());
+    for (uint32_t address = 0; address < GlobalShadow::n_registers; address++) {
+        bool dirty = false;
+        bool same = true;
+        for (size_t i = 0; i < round.chips.size(); i++) {
+            const Chip& chip = m_chips[round.chips[i]];
+            values[i] = register_word(*chip.fe, address);
+            dirty = dirty || !chip.shadow->holds(address, values[i]);
+            same = same && values[i] == values[0];
+        }
+        if (!dirty) continue;
+
+        if (same && round.chips.size() > 1 && round.stage == 0) {
+            // writing a chip that already holds the value is harmless
+            batch.write_register(broadcast_chip_id, address, values[0]);
+            n_written++;
+            for (size_t ichip : round.chips) m_chips[ichip].shadow->record(address, values[0]);
+            RD53B_METRICS_COUNT("config_scheduler.broadcasts", 1);
+        } else {
+            for (size_t i = 0; i < round.chips.size(); i++) {
+                const Chip& chip = m_chips[round.chips[i]];
+                if (chip.shadow->holds(address, values[i])) continue;
+                batch.write_register(chip.fe->getChipId(), address, values[i]);
+                chip.shadow->record(address, values[i]);
+                n_written++;
+            }
+        }
+        if (address == 13) batch.wait(std::chrono::microseconds(100));
+    }
+
+    try {
+        batch.send(hw);
+        rd53b::wait::cmd_empty(hw);
+    } catch (...) {
+        // what made it to the chips is unknown
+        for (size_t ichip : round.chips) m_chips[ichip].shadow->invalidate();
+        throw;
+    }
+    return n_written;
+}
+
+size_t rd53b::command::ConfigScheduler::configure_global(std::unique_ptr<SpecController>& hw,
+                                                         size_t stage) {
+    size_t n_written = 0;
+    for (const auto& round : m_rounds) {
+        if (round.stage != stage) continue;
+        hw->setCmdEnable(round.tx_channels);
+        n_written += configure_global(hw, round);
+    }
+    RD53B_METRICS_COUNT("config_scheduler.register_writes", n_written);
+    return n_written;
+}
+
+size_t rd53b::command::ConfigScheduler::configure_global(std::unique_ptr<SpecController>& hw) {
+    size_t n_written = 0;
+    for (size_t stage = 0; stage < n_stages(); stage++) n_written += configure_global(hw, stage);
+    return n_written;
+}
+
+void rd53b::command::ConfigScheduler::configure_pixels(std::unique_ptr<SpecController>& hw,
+                                                       size_t stage) {
+    // the pixel matrices differ from chip to chip once tuned: they are
+    // written chip by chip, with the chip's own id, within the TX channels
+    // of its round
+    for (const auto& round : m_rounds) {
+        if (round.stage != stage) continue;
+        hw->setCmdEnable(round.tx_channels);
+        for (size_t ichip : round.chips) {
+            m_chips[ichip].fe->configurePixels();
+        }
+        rd53b::wait::cmd_empty(hw);
+    }
+}
+
+void rd53b::command::ConfigScheduler::configure_pixels(std::unique_ptr<SpecController>& hw) {
+    for (size_t stage = 0; stage < n_stages(); stage++) configure_pixels(hw, stage);
+}
+
+void rd53b::command::ConfigScheduler::configure(std::unique_ptr<SpecController>& hw) {
+    RD53B_METRICS_TIMER(timer, "config_scheduler.configure_ns");
+    for (size_t stage = 0; stage < n_stages(); stage++) {
+        if (stage > 0) {
+            // the chips of the previous stage are configured: give those
+            // depending on them their time
+            std::chrono::milliseconds delay(0);
+            for (const auto& chip : m_chips) {
+                if (chip.stage == stage) delay = std::max(delay, chip.delay);
+            }
+            std::this_thread::sleep_for(delay);
+        }
+        configure_init(hw, stage);
+        configure_global(hw, stage);
+        configure_pixels(hw, stage);
+    }
+    enable_all(hw);
+}
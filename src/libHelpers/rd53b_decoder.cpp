@@ -0,0 +1,294 @@
+#include "rd53b_decoder.h"
+#include "rd53b_bit_reader.h"
+#include "rd53b_hit_kernels.h"
+#include "rd53b_hitmap_decoder.h"
+#include "rd53b_metrics.h"
+
+// yarr
+#include "LUT_PlainHMapToColRow.h"
+
+// std/stl
+#include <array>
+#include <stdexcept>
+#include <string>
+
+namespace {
+const uint8_t PToT_maskStaging[4][4] = {
+    {0, 1, 2, 3},
+    {4, 5, 6, 7},
+    {2, 3, 0, 1},
+    {6, 7, 4, 5}};
+};  // namespace
+
+std::map<unsigned, std::vector<rd53b::decoder::Stream>>
+rd53b::decoder::build_streams(BlockSpan blocks, std::vector<uint64_t>& storage,
+                              bool keep_last) {
+    // first pass: count the blocks of each channel to lay out the storage
+    std::array<size_t, 4> n_blocks = {0, 0, 0, 0};
+    for (auto block : blocks) {
+        n_blocks[(block >> 61) & 0x3]++;
+    }
+    std::array<size_t, 4> offset = {0, 0, 0, 0};
+    for (unsigned ch_id = 1; ch_id < 4; ch_id++) {
+        offset[ch_id] = offset[ch_id - 1] + n_blocks[ch_id - 1];
+    }
+    storage.resize(blocks.size());
+
+    // second pass: place the blocks and record the stream boundaries
+    std::map<unsigned, std::vector<Stream>> stream_map;
+    std::array<size_t, 4> stream_start = offset;
+    std::array<bool, 4> in_stream = {false, false, false, false};
+    for (auto block : blocks) {
+        uint8_t ns_bit = (block >> 63) & 0x1;
+        uint8_t ch_id = (block >> 61) & 0x3;
+        size_t idx = offset[ch_id]++;
+        if (ns_bit == 1) {
+            if (in_stream[ch_id]) {
+                Stream st;
+                st.chip_id = ch_id;
+                st.blocks.ptr = storage.data() + stream_start[ch_id];
+                st.blocks.len = idx - stream_start[ch_id];
+                stream_map[ch_id].push_back(st);
+            }
+            in_stream[ch_id] = true;
+            stream_start[ch_id] = idx;
+        }
+        storage[idx] = block;
+    }
+    if (keep_last) {
+        for (unsigned ch_id = 0; ch_id < 4; ch_id++) {
+            if (!in_stream[ch_id]) continue;
+            Stream st;
+            st.chip_id = ch_id;
+            st.blocks.ptr = storage.data() + stream_start[ch_id];
+            st.blocks.len = offset[ch_id] - stream_start[ch_id];
+            stream_map[ch_id].push_back(st);
+        }
+    }
+    return stream_map;
+}
+
+namespace {
+// decode a stream; corrupted data throw, unless "errors" is given in which
+// case the whole stream is dropped and its error counted; the tags of all
+// its events are appended to "tags", if given
+size_t decode(const rd53b::decoder::Stream& stream,
+              rd53b::decoder::EventBuffer& events, bool drop_tot,
+              bool do_compressed_hitmap, bool use_ptot,
+              rd53b::decoder::DecodeErrors* errors,
+              std::vector<uint16_t>* tags = nullptr) {
+    using namespace RD53BDecoding;
+    using namespace rd53b::decoder;
+    static const ExpandHitsFn expand_hits = expand_hits_kernel();
+    const HitmapDecoder& hitmap_decoder = HitmapDecoder::instance();
+
+    const BlockSpan& data = stream.blocks;
+    if (data.empty()) {
+        return 0;
+    }
+    uint8_t ch_id = (data[0] >> 61) & 0x3;
+    BitReader reader(data.data(), data.size());
+    uint16_t tag = reader.read(8);
+
+    // loop over all events in the stream
+    size_t first_event = events.n_events();
+    size_t first_hit = events.n_hits();
+    size_t first_tag = tags ? tags->size() : 0;
+    auto begin_event = [&](uint16_t event_tag) {
+        events.begin_event(event_tag);
+        if (tags) tags->push_back(event_tag);
+    };
+    begin_event(tag);
+
+    // the message is only built when it is thrown
+    auto fail = [&](DecodeError error, auto message) -> size_t {
+        if (!errors) {
+            throw std::runtime_error(message());
+        }
+        errors->n[static_cast<unsigned>(error)]++;
+        events.truncate(first_event);
+        if (tags) tags->resize(first_tag);
+        return 0;
+    };
+    // the reader yields zeros past the end of the stream: a record cut off
+    // there would otherwise pass for one with zero ToT, followed by the end
+    // of stream marker
+    auto fail_past_end = [&]() -> size_t {
+        if (reader.unexpected_ns()) {
+            return fail(DecodeError::unexpected_ns, [&] {
+                return "Unexpected NS bit seen for CH.ID = " + std::to_string(ch_id);
+            });
+        }
+        return fail(DecodeError::past_end, [&] {
+            return "Decoding error: read past the end of the stream (chip id = " +
+                   std::to_string(ch_id) + ", tag = " + std::to_string(tag) + ")";
+        });
+    };
+    while (true) {
+        bool was_past_end = reader.past_end();
+        uint16_t ccol = reader.read(6);
+
+        // if ccol is 0 this is the end of stream marker and nothing beyond it
+        // is valid data; a stream filling its last block may end within the
+        // marker, but not before it
+        if (ccol == 0) {
+            if (was_past_end) {
+                return fail_past_end();
+            }
+            break;
+        }
+
+        // valid ccol are < 56 (0b111000) and any ccol greater or equal to 56
+        // indicates that the next field is an internal tag, not a ccol!
+        if (ccol >= 56) {
+            tag = (ccol << 5) | reader.read(5);  // rest of the 11-bit internal tag
+            begin_event(tag);
+            continue;
+        }
+
+        if (ccol > 50) {
+            return fail(DecodeError::bad_address, [&] {
+                return "Decoding error: invalid core column (ccol = " +
+                       std::to_string(ccol) + ", chip id = " + std::to_string(ch_id) +
+                       ", tag = " + std::to_string(tag) + ")";
+            });
+        }
+
+        // loop over all hits in the core column
+        uint16_t col_base = (ccol - 1) * 8;
+        uint8_t qrow = 0;
+        uint8_t is_last = 0;
+        do {
+            is_last = reader.read(1);
+            uint8_t is_neighbor = reader.read(1);
+            if (is_neighbor == 1) {
+                qrow = qrow + 1;
+            } else {
+                qrow = reader.read(8);
+            }
+            if (qrow >= 192 && qrow < 196) {
+                return fail(DecodeError::bad_address, [&] {
+                    return "Decoding error: invalid quarter row (ccol = " +
+                           std::to_string(ccol) + ", qrow = " + std::to_string(qrow) +
+                           ", chip id = " + std::to_string(ch_id) +
+                           ", tag = " + std::to_string(tag) + ")";
+                });
+            }
+
+            uint16_t hitmap = 0;
+            if (do_compressed_hitmap) {
+                unsigned n_bits = 0;
+                hitmap = hitmap_decoder.decode(
+                    reader.peek(HitmapDecoder::max_code_bits), n_bits);
+                reader.consume(n_bits);
+            } else {
+                hitmap = reader.read(16);
+            }
+            if (reader.past_end()) {
+                return fail_past_end();
+            }
+
+            if (qrow >= 196) {
+                for (unsigned ibus = 0; ibus < 4; ibus++) {
+                    uint8_t hitbus = (hitmap >> (ibus << 2)) & 0xf;
+                    if (hitbus) {
+                        uint16_t ptot_ptoa_buf = 0xffff;
+                        for (unsigned iread = 0; iread < 4; iread++) {
+                            if ((hitbus >> iread) & 0x1) {
+                                ptot_ptoa_buf &= ~((~reader.read(4) & 0xf) << (iread << 2));
+                            }
+                        }  // iread
+                        if (reader.past_end()) {
+                            return fail_past_end();
+                        }
+                        unsigned step = 0;
+                        events.add_hit(col_base + PToT_maskStaging[step % 4][ibus],
+                                       step / 2, 0, ptot_ptoa_buf);
+                    }  // if hitbus
+                }      // ibus
+            } else if (!use_ptot) {
+                unsigned n_tots = _LUT_PlainHMap_To_ColRow_ArrSize[hitmap];
+                if (n_tots == 0) {
+                    return fail(DecodeError::no_tot, [&] {
+                        return "Decoding error: received fragment with no ToT (ccol = " +
+                               std::to_string(ccol) + ", qrow = " + std::to_string(qrow) +
+                               ", chip id = " + std::to_string(ch_id) +
+                               ", tag = " + std::to_string(tag) + ")";
+                    });
+                }
+                uint64_t tot_field = drop_tot ? 0 : reader.read(n_tots << 2);
+                if (reader.past_end()) {
+                    return fail_past_end();
+                }
+                uint16_t row_base = qrow * 2;
+
+                // write all candidate hits straight into the columns and only
+                // keep those with non-zero ToT (or all of them without ToT);
+                // the kernels may write all 16 lanes of the quarter core
+                size_t ihit_out = events.extend(16);
+                size_t n_kept = expand_hits(hitmap, tot_field, col_base, row_base,
+                                            drop_tot, events.col() + ihit_out,
+                                            events.row() + ihit_out,
+                                            events.tot() + ihit_out,
+                                            events.ptot_ptoa() + ihit_out);
+                events.shrink(16 - n_kept);
+            }
+        } while (!is_last);
+    }  // event loop
+
+    // streams without any hit do not produce events
+    if (events.n_hits() == first_hit) {
+        events.truncate(first_event);
+    }
+    return events.n_events() - first_event;
+}
+};  // namespace
+
+const char* rd53b::decoder::to_string(DecodeError error) {
+    switch (error) {
+        case DecodeError::no_tot:
+            return "no ToT";
+        case DecodeError::past_end:
+            return "past end of stream";
+        case DecodeError::bad_address:
+            return "bad address";
+        case DecodeError::unexpected_ns:
+            return "unexpected NS bit";
+    }
+    return "unknown";
+}
+
+size_t rd53b::decoder::decode_stream(const Stream& stream, EventBuffer& events,
+                                    bool drop_tot, bool do_compressed_hitmap,
+                                    bool use_ptot) {
+    RD53B_METRICS_TIMER(timer, "decode.stream_ns");
+    size_t n_events = decode(stream, events, drop_tot, do_compressed_hitmap, use_ptot, nullptr);
+    RD53B_METRICS_COUNT("decode.streams", 1);
+    RD53B_METRICS_COUNT("decode.blocks", stream.blocks.size());
+    RD53B_METRICS_COUNT("decode.events", n_events);
+    return n_events;
+}
+
+size_t rd53b::decoder::decode_stream(const Stream& stream, EventBuffer& events,
+                                    DecodeErrors& errors, bool drop_tot,
+                                    bool do_compressed_hitmap, bool use_ptot) {
+    RD53B_METRICS_TIMER(timer, "decode.stream_ns");
+    size_t n_events = decode(stream, events, drop_tot, do_compressed_hitmap, use_ptot, &errors);
+    RD53B_METRICS_COUNT("decode.streams", 1);
+    RD53B_METRICS_COUNT("decode.blocks", stream.blocks.size());
+    RD53B_METRICS_COUNT("decode.events", n_events);
+    return n_events;
+}
+
+size_t rd53b::decoder::decode_stream(const Stream& stream, EventBuffer& events,
+                                    std::vector<uint16_t>& tags, DecodeErrors& errors,
+                                    bool drop_tot, bool do_compressed_hitmap,
+                                    bool use_ptot) {
+    RD53B_METRICS_TIMER(timer, "decode.stream_ns");
+    size_t n_events =
+        decode(stream, events, drop_tot, do_compressed_hitmap, use_ptot, &errors, &tags);
+    RD53B_METRICS_COUNT("decode.streams", 1);
+    RD53B_METRICS_COUNT("decode.blocks", stream.blocks.size());
+    RD53B_METRICS_COUNT("decode.events", n_events);
+    return n_events;
+}
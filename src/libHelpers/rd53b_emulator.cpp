@@ -0,0 +1,226 @@
+#include "rd53b_emulator.h"
+#include "rd53b_trigger.h"  // event_tags
+
+// std/stl
+#include <algorithm>  // min, sort, unique
+
+namespace {
+const unsigned n_cols = 400;
+const unsigned n_rows = 384;
+const unsigned n_ccols = n_cols / 8;
+// pixels sharing a PToT hit bus
+const unsigned n_pixels_per_bus = 8 * n_rows / 4;
+};  // namespace
+
+rd53b::emulator::EmulatedSpecController::EmulatedSpecController()
+    : m_encoder(m_compressed_hitmap, m_drop_tot, m_use_ptot),
+      m_chip_blocks(m_chip_ids.size()) {}
+
+void rd53b::emulator::EmulatedSpecController::configure_emulation(
+    const json& config) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (config.find("chipIds") != config.end()) {
+        m_chip_ids.clear();
+        for (const auto& chip_id : config.at("chipIds")) {
+            m_chip_ids.push_back(chip_id.get<unsigned>() & 0xf);
+        }
+    }
+    m_occupancy = config.value("occupancy", m_occupancy);
+    m_compressed_hitmap = config.value("compressedHitmap", m_compressed_hitmap);
+    m_drop_tot = config.value("dropTot", m_drop_tot);
+    m_use_ptot = config.value("ptot", m_use_ptot);
+    m_events_per_stream = std::max(1u, config.value("eventsPerStream", m_events_per_stream));
+    m_triggers_per_read = std::max<size_t>(1, config.value("triggersPerRead", m_triggers_per_read));
+    m_real_time = config.value("realTime", m_real_time);
+    m_rng.seed(config.value("seed", 1u));
+
+    m_encoder = rd53b::encoder::StreamEncoder(m_compressed_hitmap, m_drop_tot, m_use_ptot);
+    m_chip_blocks.assign(m_chip_ids.size(), {});
+}
+
+void rd53b::emulator::EmulatedSpecController::writeFifo(uint32_t /*value*/) {
+    m_n_cmd_words++;
+}
+
+void rd53b::emulator::EmulatedSpecController::setCmdEnable(
+    std::vector<uint32_t> channels) {
+    m_cmd_enable = 0;
+    for (auto channel : channels) m_cmd_enable |= (1 << channel);
+}
+
+void rd53b::emulator::EmulatedSpecController::setRxEnable(
+    std::vector<uint32_t> channels) {
+    m_rx_enable = 0;
+    for (auto channel : channels) m_rx_enable |= (1 << channel);
+}
+
+void rd53b::emulator::EmulatedSpecController::setupMode() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_run_mode = false;
+}
+
+void rd53b::emulator::EmulatedSpecController::runMode() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_run_mode = true;
+}
+
+void rd53b::emulator::EmulatedSpecController::setTrigEnable(uint32_t value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (value != 0 && m_trig_enable == 0) {
+        m_trig_start = std::chrono::steady_clock::now();
+    } else if (value == 0 && m_trig_enable != 0) {
+        // what has fired stays to be read out
+        m_n_triggers_fired += n_triggers_due();
+    }
+    m_trig_enable = value;
+}
+
+uint32_t rd53b::emulator::EmulatedSpecController::getTrigEnable() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_trig_enable;
+}
+
+void rd53b::emulator::EmulatedSpecController::setTrigConfig(
+    enum TRIG_CONF_VALUE cfg) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trig_config = cfg;
+}
+
+void rd53b::emulator::EmulatedSpecController::setTrigFreq(double freq) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trig_freq = freq;
+}
+
+void rd53b::emulator::EmulatedSpecController::setTrigCnt(uint32_t count) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trig_count = count;
+}
+
+void rd53b::emulator::EmulatedSpecController::setTrigTime(double time) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trig_time = time;
+}
+
+void rd53b::emulator::EmulatedSpecController::setTrigWordLength(
+    uint32_t /*length*/) {}
+
+void rd53b::emulator::EmulatedSpecController::setTrigWord(uint32_t* word,
+                                                          uint32_t size) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_trigger_tags = rd53b::trigger::event_tags(word, size);
+
+    // a trigger word without trigger commands still gives one event
+    if (m_trigger_tags.empty()) {
+        m_trigger_tags.push_back(0);
+    }
+}
+
+size_t rd53b::emulator::EmulatedSpecController::n_triggers_total() const {
+    switch (m_trig_config) {
+        case INT_COUNT:
+            return m_trig_count;
+        case INT_TIME:
+            return static_cast<size_t>(m_trig_time * m_trig_freq);
+        default:
+            return 0;
+    }
+}
+
+size_t rd53b::emulator::EmulatedSpecController::n_triggers_due() const {
+    size_t n_total = n_triggers_total();
+    if (!m_real_time) {
+        return n_total;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - m_trig_start;
+    return std::min(n_total, static_cast<size_t>(elapsed.count() * m_trig_freq));
+}
+
+size_t rd53b::emulator::EmulatedSpecController::n_triggers_fired() const {
+    return m_n_triggers_fired + (m_trig_enable != 0 ? n_triggers_due() : 0);
+}
+
+bool rd53b::emulator::EmulatedSpecController::isTrigDone() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_trig_enable == 0 || n_triggers_due() >= n_triggers_total();
+}
+
+void rd53b::emulator::EmulatedSpecController::flushBuffer() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_n_triggers_sent = n_triggers_fired();
+}
+
+void rd53b::emulator::EmulatedSpecController::generate_event(
+    uint16_t tag, rd53b::decoder::EventBuffer& events) {
+    events.begin_event(tag);
+
+    if (m_use_ptot) {
+        std::bernoulli_distribution bus_hit(
+            std::min(1.0, m_occupancy * n_pixels_per_bus));
+        std::uniform_int_distribution<uint16_t> ptot_ptoa(0, 0xffff);
+        for (unsigned ccol = 0; ccol < n_ccols; ccol++) {
+            for (unsigned ibus = 0; ibus < 4; ibus++) {
+                if (bus_hit(m_rng)) {
+                    events.add_hit(ccol * 8 + ibus, 0, 0, ptot_ptoa(m_rng));
+                }
+            }
+        }
+        return;
+    }
+
+    std::binomial_distribution<unsigned> n_hits(n_cols * n_rows, m_occupancy);
+    std::uniform_int_distribution<uint32_t> pixel(0, n_cols * n_rows - 1);
+    std::uniform_int_distribution<unsigned> tot(1, 15);
+    m_pixels.clear();
+    for (unsigned n = n_hits(m_rng); n > 0; n--) {
+        m_pixels.push_back(pixel(m_rng));
+    }
+    std::sort(m_pixels.begin(), m_pixels.end());
+    m_pixels.erase(std::unique(m_pixels.begin(), m_pixels.end()), m_pixels.end());
+    for (auto p : m_pixels) {
+        events.add_hit(p % n_cols, p / n_cols, m_drop_tot ? 0 : tot(m_rng));
+    }
+}
+
+RawData* rd53b::emulator::EmulatedSpecController::readData() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_run_mode) {
+        return nullptr;
+    }
+    size_t n_fired = n_triggers_fired();
+    if (n_fired <= m_n_triggers_sent) {
+        return nullptr;
+    }
+    size_t n_triggers = std::min(n_fired - m_n_triggers_sent, m_triggers_per_read);
+    m_n_triggers_sent += n_triggers;
+
+    // every chip sees the same triggers, each with its own hits
+    size_t n_events = n_triggers * m_trigger_tags.size();
+    size_t n_blocks = 0;
+    for (size_t ichip = 0; ichip < m_chip_ids.size(); ichip++) {
+        auto& blocks = m_chip_blocks[ichip];
+        blocks.clear();
+        m_events.clear();
+        for (size_t ievent = 0; ievent < n_events; ievent++) {
+            generate_event(m_trigger_tags[ievent % m_trigger_tags.size()], m_events);
+        }
+        for (size_t first = 0; first < n_events; first += m_events_per_stream) {
+            size_t n = std::min<size_t>(m_events_per_stream, n_events - first);
+            m_encoder.encode(m_events, first, n, m_chip_ids[ichip] & 0x3, blocks);
+        }
+        n_blocks += blocks.size();
+    }
+
+    // interleave the chips block by block, as the data merging does
+    uint32_t* buf = new uint32_t[2 * n_blocks];
+    size_t iword = 0;
+    for (size_t iblock = 0; iword < 2 * n_blocks; iblock++) {
+        for (const auto& blocks : m_chip_blocks) {
+            if (iblock < blocks.size()) {
+                buf[iword++] = blocks[iblock] >> 32;
+                buf[iword++] = blocks[iblock] & 0xffffffff;
+            }
+        }
+    }
+    return new RawData(0, buf, 2 * n_blocks);
+}
@@ -0,0 +1,249 @@
+#include "rd53b_encoder.h"
+
+// yarr
+#include "LUT_PlainHMapToColRow.h"
+#include "LUT_BinaryTreeRowHMap.h"
+#include "LUT_BinaryTreeHitMap.h"
+
+// std/stl
+#include <algorithm>  // sort
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// qrow of the PToT records
+const uint8_t ptot_qrow = 196;
+
+struct Code {
+    uint16_t bits = 0;
+    uint8_t len = 0;  // 0: no code
+};
+
+//
+// The decoder's lookup tables, inverted.
+//
+// A compressed hitmap is either resolved by a single lookup of the
+// 16-bit hitmap table ("single"), or that lookup resolves the first row
+// and a lookup of the 14-bit row table resolves the second ("first" and
+// "second", indexed by the row byte).
+//
+struct Tables {
+    Code single[65536];
+    Code first[256];
+    Code second[256];
+    // hitmap bit of each pixel of a quarter core, [col][row]
+    uint8_t hitmap_bit[8][2];
+
+    Tables() {
+        using namespace RD53BDecoding;
+        for (uint32_t peek = 0; peek < 65536; peek++) {
+            uint32_t entry = _LUT_BinaryTreeHitMap[peek];
+            uint8_t rollback_second = (entry >> 24) & 0xff;
+            unsigned len = 0;
+            Code* code = nullptr;
+            if (rollback_second == 0) {
+                uint16_t hitmap = entry & 0xffff;
+                len = 16 - ((entry >> 16) & 0xff);
+                code = &single[hitmap];
+            } else {
+                len = rollback_second == 0xff ? 16 : 16 - rollback_second;
+                code = &first[entry & 0xff];
+            }
+            if (len == 0 || len > 16) continue;
+            if (code->len == 0 || len < code->len) {
+                code->bits = peek >> (16 - len);
+                code->len = len;
+            }
+        }
+        for (uint32_t peek = 0; peek < 16384; peek++) {
+            uint16_t entry = _LUT_BinaryTreeRowHMap[peek];
+            unsigned len = 14 - ((entry >> 8) & 0xff);
+            Code& code = second[entry & 0xff];
+            if (len == 0 || len > 14) continue;
+            if (code.len == 0 || len < code.len) {
+                code.bits = peek >> (14 - len);
+                code.len = len;
+            }
+        }
+        for (unsigned bit = 0; bit < 16; bit++) {
+            uint8_t col_row = _LUT_PlainHMap_To_ColRow[1 << bit][0];
+            hitmap_bit[(col_row >> 4) & 0x7][col_row & 0x1] = bit;
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables t;
+    return t;
+}
+
+//
+// Appends fields, MSB first, to the payload of the stream's blocks.
+//
+class BitWriter {
+  public:
+    BitWriter(std::vector<uint64_t>& blocks, uint8_t chip_id)
+        : m_blocks(blocks), m_header(static_cast<uint64_t>(chip_id & 0x3) << 61) {
+        // the NS bit marks the first block of the stream
+        m_block = m_header | (1ULL << 63);
+    }
+
+    // the n LS bits of value, 1 <= n <= 64
+    void put(uint64_t value, unsigned n) {
+        while (n > 0) {
+            if (m_free == 0) {
+                m_blocks.push_back(m_block);
+                m_block = m_header;
+                m_free = 61;
+            }
+            unsigned k = n < m_free ? n : m_free;
+            uint64_t bits = (value >> (n - k)) & (~0ULL >> (64 - k));
+            m_block |= bits << (m_free - k);
+            m_free -= k;
+            n -= k;
+        }
+    }
+
+    void finish() { m_blocks.push_back(m_block); }
+
+  private:
+    std::vector<uint64_t>& m_blocks;
+    uint64_t m_header;
+    uint64_t m_block;
+    unsigned m_free = 61;
+};
+
+void put_hitmap(BitWriter& writer, uint16_t hitmap, bool compressed) {
+    if (!compressed) {
+        writer.put(hitmap, 16);
+        return;
+    }
+    const Tables& t = tables();
+    const Code& single = t.single[hitmap];
+    if (single.len > 0) {
+        writer.put(single.bits, single.len);
+        return;
+    }
+    const Code& first = t.first[hitmap & 0xff];
+    const Code& second = t.second[hitmap >> 8];
+    if (first.len == 0 || second.len == 0) {
+        throw std::runtime_error("Encoding error: no binary tree code for hitmap " +
+                                 std::to_string(hitmap));
+    }
+    writer.put(first.bits, first.len);
+    writer.put(second.bits, second.len);
+}
+
+};  // namespace
+
+rd53b::encoder::StreamEncoder::StreamEncoder(bool compressed_hitmap,
+                                             bool drop_tot, bool use_ptot)
+    : m_compressed_hitmap(compressed_hitmap),
+      m_drop_tot(drop_tot),
+      m_use_ptot(use_ptot) {
+    // build the tables up front rather than on the first stream
+    tables();
+}
+
+void rd53b::encoder::StreamEncoder::encode(
+    const rd53b::decoder::EventBuffer& events, size_t first_event,
+    size_t n_events, uint8_t chip_id, std::vector<uint64_t>& blocks) {
+    using namespace RD53BDecoding;
+    const Tables& t = tables();
+
+    BitWriter writer(blocks, chip_id);
+    for (size_t ievent = first_event; ievent < first_event + n_events; ievent++) {
+        uint16_t tag = events.tag(ievent);
+        if (ievent == first_event) {
+            writer.put(tag & 0xff, 8);
+        } else {
+            writer.put(tag >= 0x700 ? tag : (0x700 | (tag & 0xff)), 11);
+        }
+
+        // order the hits by core column, then quarter row (or hit bus),
+        // then hitmap bit
+        m_order.clear();
+        for (size_t h = events.hit_begin(ievent); h < events.hit_end(ievent); h++) {
+            uint64_t col = events.col()[h];
+            uint64_t row = events.row()[h];
+            uint64_t ccol = col / 8 + 1;
+            uint64_t key = 0;
+            if (m_use_ptot) {
+                key = (ccol << 48) | ((col % 8) << 32);
+            } else {
+                key = (ccol << 48) | ((row / 2) << 40) |
+                      (static_cast<uint64_t>(t.hitmap_bit[col % 8][row % 2]) << 32);
+            }
+            m_order.push_back(key | h);
+        }
+        std::sort(m_order.begin(), m_order.end());
+
+        size_t i = 0;
+        while (i < m_order.size()) {
+            uint8_t ccol = m_order[i] >> 48;
+            writer.put(ccol, 6);
+
+            // one record per quarter row (a single PToT record) of the core column
+            int prev_qrow = -1;
+            do {
+                uint8_t qrow = m_use_ptot ? ptot_qrow : (m_order[i] >> 40) & 0xff;
+                uint16_t hitmap = 0;
+                uint8_t tot_by_bit[16] = {0};
+                uint16_t ptot_by_bus[4] = {0};
+                size_t j = i;
+                for (; j < m_order.size() && (m_order[j] >> 48) == ccol; j++) {
+                    uint8_t field = (m_order[j] >> 32) & 0xff;
+                    size_t h = m_order[j] & 0xffffffff;
+                    if (m_use_ptot) {
+                        if (field > 3) {
+                            throw std::runtime_error(
+                                "Encoding error: PToT hit on column " +
+                                std::to_string(events.col()[h]) + " has no hit bus");
+                        }
+                        hitmap |= 0xf << (field << 2);
+                        ptot_by_bus[field] = events.ptot_ptoa()[h];
+                    } else {
+                        if (((m_order[j] >> 40) & 0xff) != qrow) break;
+                        hitmap |= 1 << field;
+                        tot_by_bit[field] = events.tot()[h];
+                    }
+                }
+                bool is_last = j == m_order.size() || (m_order[j] >> 48) != ccol;
+                bool is_neighbor = prev_qrow >= 0 && qrow == prev_qrow + 1;
+                writer.put(is_last, 1);
+                writer.put(is_neighbor, 1);
+                if (!is_neighbor) {
+                    writer.put(qrow, 8);
+                }
+                put_hitmap(writer, hitmap, m_compressed_hitmap);
+
+                if (m_use_ptot) {
+                    for (unsigned ibus = 0; ibus < 4; ibus++) {
+                        if (((hitmap >> (ibus << 2)) & 0xf) == 0) continue;
+                        for (unsigned iread = 0; iread < 4; iread++) {
+                            writer.put((ptot_by_bus[ibus] >> (iread << 2)) & 0xf, 4);
+                        }
+                    }
+                } else if (!m_drop_tot) {
+                    // the ToT of the i-th hit the decoder finds in the
+                    // hitmap goes in the i-th nibble
+                    unsigned n_tots = _LUT_PlainHMap_To_ColRow_ArrSize[hitmap];
+                    uint64_t tot_field = 0;
+                    for (unsigned ihit = 0; ihit < n_tots; ihit++) {
+                        uint8_t col_row = _LUT_PlainHMap_To_ColRow[hitmap][ihit];
+                        uint8_t bit = t.hitmap_bit[(col_row >> 4) & 0x7][col_row & 0x1];
+                        tot_field |= static_cast<uint64_t>(tot_by_bit[bit] & 0xf) << (ihit << 2);
+                    }
+                    writer.put(tot_field, n_tots << 2);
+                }
+                prev_qrow = qrow;
+                i = j;
+            } while (i < m_order.size() && (m_order[i] >> 48) == ccol);
+        }
+    }
+
+    // end of stream
+    writer.put(0, 6);
+    writer.finish();
+}
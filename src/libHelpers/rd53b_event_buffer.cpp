@@ -0,0 +1,108 @@
+#include "rd53b_event_buffer.h"
+
+// std/stl
+#include <algorithm>  // max, min
+#include <cstring>    // memcpy
+#include <new>        // align_val_t
+#include <utility>    // swap
+
+namespace {
+const size_t arena_alignment = 64;
+const size_t min_hit_capacity = 1024;
+};  // namespace
+
+rd53b::decoder::EventBuffer::EventBuffer(size_t hit_capacity,
+                                         size_t event_capacity) {
+    reserve(hit_capacity, event_capacity);
+}
+
+rd53b::decoder::EventBuffer::~EventBuffer() {
+    if (m_arena) {
+        ::operator delete(m_arena, std::align_val_t(arena_alignment));
+    }
+}
+
+rd53b::decoder::EventBuffer::EventBuffer(EventBuffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+rd53b::decoder::EventBuffer& rd53b::decoder::EventBuffer::operator=(
+    EventBuffer&& other) noexcept {
+    std::swap(m_arena, other.m_arena);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_n_hits, other.m_n_hits);
+    std::swap(m_col, other.m_col);
+    std::swap(m_row, other.m_row);
+    std::swap(m_ptot_ptoa, other.m_ptot_ptoa);
+    std::swap(m_tot, other.m_tot);
+    m_tag.swap(other.m_tag);
+    m_hit_offset.swap(other.m_hit_offset);
+    return *this;
+}
+
+void rd53b::decoder::EventBuffer::truncate(size_t n_events) {
+    if (n_events >= m_tag.size()) return;
+    m_n_hits = m_hit_offset[n_events];
+    m_tag.resize(n_events);
+    m_hit_offset.resize(n_events);
+}
+
+void rd53b::decoder::EventBuffer::reserve(size_t hit_capacity,
+                                          size_t event_capacity) {
+    if (hit_capacity > m_capacity) {
+        grow(hit_capacity);
+    }
+    m_tag.reserve(event_capacity);
+    m_hit_offset.reserve(event_capacity);
+}
+
+void rd53b::decoder::EventBuffer::append(const EventBuffer& other,
+                                         size_t first_event, size_t n_events) {
+    if (first_event >= other.n_events()) return;
+    size_t end_event = first_event + std::min(n_events, other.n_events() - first_event);
+    size_t src_hit = other.hit_begin(first_event);
+    size_t n_hits = other.hit_end(end_event - 1) - src_hit;
+    size_t first_hit = extend(n_hits);
+    if (n_hits > 0) {
+        std::memcpy(m_col + first_hit, other.m_col + src_hit, n_hits * sizeof(uint16_t));
+        std::memcpy(m_row + first_hit, other.m_row + src_hit, n_hits * sizeof(uint16_t));
+        std::memcpy(m_ptot_ptoa + first_hit, other.m_ptot_ptoa + src_hit, n_hits * sizeof(uint16_t));
+        std::memcpy(m_tot + first_hit, other.m_tot + src_hit, n_hits * sizeof(uint8_t));
+    }
+    for (size_t ievent = first_event; ievent < end_event; ievent++) {
+        m_tag.push_back(other.m_tag[ievent]);
+        m_hit_offset.push_back(static_cast<uint32_t>(first_hit + other.m_hit_offset[ievent] - src_hit));
+    }
+}
+
+void rd53b::decoder::EventBuffer::grow(size_t min_capacity) {
+    // a multiple of the alignment keeps every column aligned when they are
+    // laid out back to back
+    size_t capacity = std::max({min_capacity, 2 * m_capacity, min_hit_capacity});
+    capacity = (capacity + arena_alignment - 1) / arena_alignment * arena_alignment;
+
+    size_t column_bytes_16 = capacity * sizeof(uint16_t);
+    size_t bytes = 3 * column_bytes_16 + capacity * sizeof(uint8_t);
+    auto arena = static_cast<uint8_t*>(
+        ::operator new(bytes, std::align_val_t(arena_alignment)));
+
+    auto col = reinterpret_cast<uint16_t*>(arena);
+    auto row = reinterpret_cast<uint16_t*>(arena + column_bytes_16);
+    auto ptot_ptoa = reinterpret_cast<uint16_t*>(arena + 2 * column_bytes_16);
+    auto tot = arena + 3 * column_bytes_16;
+
+    if (m_arena) {
+        std::memcpy(col, m_col, m_n_hits * sizeof(uint16_t));
+        std::memcpy(row, m_row, m_n_hits * sizeof(uint16_t));
+        std::memcpy(ptot_ptoa, m_ptot_ptoa, m_n_hits * sizeof(uint16_t));
+        std::memcpy(tot, m_tot, m_n_hits * sizeof(uint8_t));
+        ::operator delete(m_arena, std::align_val_t(arena_alignment));
+    }
+
+    m_arena = arena;
+    m_capacity = capacity;
+    m_col = col;
+    m_row = row;
+    m_ptot_ptoa = ptot_ptoa;
+    m_tot = tot;
+}
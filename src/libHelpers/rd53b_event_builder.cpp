@@ -0,0 +1,127 @@
+#include "rd53b_event_builder.h"
+#include "rd53b_metrics.h"
+
+// std/stl
+#include <utility>  // move, swap
+
+namespace {
+// a queue is compacted once this many of its events have been consumed
+// (and they are at least half of it)
+const size_t compact_events = 256;
+};  // namespace
+
+rd53b::decoder::EventBuilder::EventBuilder(Callback on_event,
+                                           uint8_t channel_mask, size_t window)
+    : m_on_event(std::move(on_event)),
+      m_channel_mask(channel_mask & 0xf),
+      m_window(window) {
+    m_event.m_hits = &m_built;
+}
+
+void rd53b::decoder::EventBuilder::push(unsigned ch_id,
+                                        const EventBuffer& events) {
+    if (ch_id >= n_channels || !((m_channel_mask >> ch_id) & 0x1)) return;
+    if (events.n_events() == 0) return;
+
+    // until a first event is emitted, the tags are ordered from just
+    // before the oldest one seen: a chip may start with a later tag than
+    // another (its first streams had no hits)
+    if (!m_emitted) {
+        uint8_t first_tag = events.tag(0) & 0xff;
+        if (!m_started || distance(first_tag) <= 0) {
+            m_last_tag = static_cast<uint8_t>(first_tag - 1);
+        }
+        m_started = true;
+    }
+
+    Queue& queue = m_queues[ch_id];
+    if (queue.empty()) {
+        queue.events.clear();
+        queue.head = 0;
+    } else if (queue.head >= compact_events && 2 * queue.head >= queue.events.n_events()) {
+        m_compact.clear();
+        m_compact.append(queue.events, queue.head);
+        std::swap(queue.events, m_compact);
+        queue.head = 0;
+    }
+    queue.events.append(events);
+    m_n_pending += events.n_events();
+
+    while (emit(m_n_pending > m_window)) {
+    }
+    RD53B_METRICS_RECORD("event_builder.pending", "events", m_n_pending);
+}
+
+void rd53b::decoder::EventBuilder::flush() {
+    while (emit(true)) {
+    }
+}
+
+void rd53b::decoder::EventBuilder::reset() {
+    for (auto& queue : m_queues) {
+        queue.events.clear();
+        queue.head = 0;
+    }
+    m_started = false;
+    m_emitted = false;
+    m_n_pending = 0;
+    m_n_events = 0;
+    m_n_partial = 0;
+    m_n_forced = 0;
+    m_n_late = 0;
+}
+
+bool rd53b::decoder::EventBuilder::emit(bool force) {
+    if (m_n_pending == 0) return false;
+
+    // the oldest tag at the front of the queues
+    bool found = false;
+    uint8_t tag = 0;
+    for (unsigned ch_id = 0; ch_id < n_channels; ch_id++) {
+        const Queue& queue = m_queues[ch_id];
+        if (queue.empty()) continue;
+        if (!found || distance(queue.front_tag()) < distance(tag)) {
+            tag = queue.front_tag();
+            found = true;
+        }
+    }
+
+    // a late event, its tag was already emitted; nothing is late before
+    // the first event
+    bool late = m_emitted && distance(tag) <= 0;
+
+    // a chip with nothing queued may still send this tag
+    bool complete = true;
+    for (unsigned ch_id = 0; ch_id < n_channels; ch_id++) {
+        if (((m_channel_mask >> ch_id) & 0x1) && m_queues[ch_id].empty()) {
+            complete = false;
+        }
+    }
+    if (!complete && !force && !late) return false;
+
+    m_built.clear();
+    m_event.m_chip_mask = 0;
+    for (unsigned ch_id = 0; ch_id < n_channels; ch_id++) {
+        Queue& queue = m_queues[ch_id];
+        if (queue.empty() || queue.front_tag() != tag) continue;
+        m_event.m_event[ch_id] = m_built.n_events();
+        m_built.append(queue.events, queue.head, 1);
+        queue.head++;
+        m_event.m_chip_mask |= (1 << ch_id);
+        m_n_pending--;
+    }
+    m_event.m_tag = tag;
+    m_event.m_forced = !complete && !late;
+    if (!late) {
+        m_last_tag = tag;
+        m_emitted = true;
+    }
+
+    m_n_events++;
+    RD53B_METRICS_COUNT("event_builder.events", 1);
+    if (m_event.m_chip_mask != m_channel_mask) m_n_partial++;
+    if (m_event.m_forced) m_n_forced++;
+    if (late) m_n_late++;
+    m_on_event(m_event);
+    return true;
+}
@@ -12,6 +12,16 @@
 //#include "Rd53b.h"
 #include "ScanHelper.h"  // openJsonFile, loadController
 
+// itkpix_dataflow
+#include "rd53b_command_batch.h"
+#include "rd53b_config_cache.h"
+#include "rd53b_emulator.h"
+#include "rd53b_pixel_shadow.h"
+#include "rd53b_register_shadow.h"
+#include "rd53b_metrics.h"
+#include "rd53b_trigger.h"
+#include "rd53b_wait.h"
+
 // std/stl
 #include <array>
 #include <experimental/filesystem>
@@ -29,7 +39,13 @@ std::unique_ptr<SpecController> rd53b::helpers::spec_init(std::string config) {
     json hw_config;
     try {
         hw_config = ScanHelper::openJsonFile(config);
-        hw = ScanHelper::loadController(hw_config);
+        if (hw_config["ctrlCfg"]["type"] == rd53b::emulator::controller_type) {
+            auto emu = std::make_unique<rd53b::emulator::EmulatedSpecController>();
+            emu->configure_emulation(hw_config["ctrlCfg"]["cfg"]);
+            hw = std::move(emu);
+        } else {
+            hw = ScanHelper::loadController(hw_config);
+        }
         // hw =
         // std::make_unique<SpecController>(ScanHelper::loadController(hw_config));
     } catch (std::exception& e) {
@@ -48,88 +64,44 @@ std::unique_ptr<SpecController> rd53b::helpers::spec_init(std::string config) {
 
 bool rd53b::helpers::spec_init_trigger(std::unique_ptr<SpecController>& hw,
                                        json trigger_config) {
-    uint32_t m_trigDelay = trigger_config.at("delay");
-    float m_trigTime = trigger_config.at("time");
-    float m_trigFreq = trigger_config.at("frequency");
-    uint32_t m_trigWordLength = 32;
-    bool m_noInject = trigger_config.at("noInject");
-    bool m_edgeMode = trigger_config.at("edgeMode");
-    bool m_extTrig = trigger_config.at("extTrigger");
-    uint32_t m_edgeDuration = trigger_config.at("edgeDuration");
-    uint32_t m_pulseDuration = 8;
-    uint32_t m_trigMultiplier = 16;
-    std::array<uint32_t, 32> m_trigWord;
-
-    ////////////////////////////////////////////////////////////////
-    // SET TRIGGER DELAY
-    ////////////////////////////////////////////////////////////////
-    m_trigWord.fill(0xaaaaaaaa);
-    std::array<uint16_t, 3> calWords = Rd53b::genCal(16, 0, 0, 1, 0, 0);
-    m_trigWord[31] = 0xaaaa0000 | calWords[0];
-    m_trigWord[30] = ((uint32_t)calWords[1] << 16) | calWords[2];
-
-    uint64_t trigStream = 0;
-
-    uint64_t one = 1;
-    for (unsigned i = 0; i < m_trigMultiplier; i++) {
-        trigStream |= (one << i);
-    }  // i
-    trigStream = trigStream << m_trigDelay % 8;
-
-    for (unsigned i = 0; i < (m_trigMultiplier / 8) + 1; i++) {
-        if (((30 - (m_trigDelay / 8) - i) > 2) && m_trigDelay > 30) {
-            uint32_t bc1 = (trigStream >> (2 * i * 4)) & 0xf;
-            uint32_t bc2 = (trigStream >> ((2 * i * 4) + 4)) & 0xf;
-            m_trigWord[30 - (m_trigDelay / 8) - i] =
-                ((uint32_t)Rd53b::genTrigger(bc1, 2 * i)[0] << 16) |
-                Rd53b::genTrigger(bc2, (2 * i) + 1)[0];
-        } else {
-            std::cout << "Delay is either too small or too large!" << std::endl;
-        }
-    }  // i
+    rd53b::trigger::TriggerLoader loader;
+    return spec_init_trigger(hw, rd53b::trigger::TriggerConfig::from_json(trigger_config),
+                             loader);
+}
 
-    // rearm
-    std::array<uint16_t, 3> armWords = Rd53b::genCal(16, 1, 0, 0, 0, 0);
-    m_trigWord[1] = 0xaaaa0000 | armWords[0];
-    m_trigWord[0] = ((uint32_t)armWords[1] << 16) | armWords[2];
-
-    ////////////////////////////////////////////////////////////////
-    // SET EDGE MODE
-    ////////////////////////////////////////////////////////////////
-    calWords = Rd53b::genCal(16, 1, 0, m_edgeDuration, 0, 0);
-    m_trigWord[31] = 0xaaaa0000 | calWords[0];
-    m_trigWord[30] = ((uint32_t)calWords[1] << 16) | calWords[2];
-
-    ////////////////////////////////////////////////////////////////
-    // SET TRIGGER MODE
-    ////////////////////////////////////////////////////////////////
-    hw->setTrigConfig(INT_COUNT);
-    hw->setTrigCnt(trigger_config.at("count"));
-
-    ////////////////////////////////////////////////////////////////
-    // REMAINING
-    ////////////////////////////////////////////////////////////////
-    hw->setTrigFreq(m_trigFreq);
-    hw->setTrigWord(&m_trigWord[0], 32);
-    hw->setTrigWordLength(m_trigWordLength);
-    hw->setTrigTime(m_trigTime);
+bool rd53b::helpers::spec_init_trigger(std::unique_ptr<SpecController>& hw,
+                                       const rd53b::trigger::TriggerConfig& trigger_config,
+                                       rd53b::trigger::TriggerLoader& loader) {
+    loader.load(hw, trigger_config);
     return true;
 }
 
-bool rd53b::helpers::spec_trigger_loop(std::unique_ptr<SpecController>& hw) {
-    while (!hw->isCmdEmpty()) {
-    }
+bool rd53b::helpers::spec_trigger_loop(std::unique_ptr<SpecController>& hw,
+                                       std::chrono::milliseconds timeout) {
+    rd53b::wait::cmd_empty(hw);
     hw->flushBuffer();
     std::this_thread::sleep_for(std::chrono::microseconds(10));
     hw->setTrigEnable(0x1);
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    while (!hw->isTrigDone()) {
+    {
+        RD53B_METRICS_TIMER(timer, "trigger.run_ns");
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        try {
+            rd53b::wait::trig_done(hw, timeout);
+        } catch (...) {
+            hw->setTrigEnable(0x0);
+            throw;
+        }
     }
     hw->setTrigEnable(0x0);
     return true;
 }
 
+bool rd53b::helpers::spec_trigger_loop(std::unique_ptr<SpecController>& hw,
+                                       const rd53b::trigger::TriggerConfig& trigger_config) {
+    return spec_trigger_loop(hw, rd53b::trigger::done_timeout(trigger_config));
+}
+
 std::unique_ptr<Rd53b> rd53b::helpers::rd53b_init(
     std::unique_ptr<SpecController>& hw, std::string config) {
     std::unique_ptr<Rd53b> fe = std::make_unique<Rd53b>(&*hw);
@@ -158,10 +130,12 @@ std::unique_ptr<Rd53b> rd53b::helpers::rd53b_init(
         // auto chip_config = json_config["chips"]["config"];
         auto chip_config = chip_configs.at(0);
         fe->init(&*hw, chip_config["tx"], chip_config["rx"]);
-        auto chip_register_file_path = chip_config["config"];
-        auto chip_register_json =
-            ScanHelper::openJsonFile(chip_register_file_path);
-        cfg->fromFileJson(chip_register_json);
+        std::string chip_register_file_path = chip_config["config"];
+        rd53b::io::ChipConfigCache cache;
+        if (cache.load(chip_register_file_path, *fe)) {
+            std::cout << "Loaded chip configuration \"" << chip_register_file_path
+                      << "\" from the cache" << std::endl;
+        }
     } else {
         std::cout << "WARNING: "  << "Creating new Rd53b configuration file";
         std::ofstream new_cfg_file(config);
@@ -204,58 +178,62 @@ void rd53b::helpers::configure_init(std::unique_ptr<SpecController>& hw, std::un
     for(unsigned int i=0; i<32; i++)
         hw->writeFifo(0x817E817E);
     hw->releaseFifo();
-    while(!hw->isCmdEmpty());
+    rd53b::wait::cmd_empty(hw);
+
+    // The rest goes out as a single command batch, only stopping where the
+    // chip needs time
+    rd53b::command::CommandBatch batch;
+    init_sequence(batch, *fe);
+    batch.send(hw);
+    rd53b::wait::cmd_empty(hw);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+}
+
+void rd53b::helpers::init_sequence(rd53b::command::CommandBatch& batch, Rd53b& fe) {
+    uint32_t chip_id = fe.getChipId();
 
     // Enable register writing to do more resetting
     //logger->debug(" ... set global register in writeable mode");
-    fe->writeRegister(&Rd53b::GcrDefaultConfig, 0xAC75);
-    fe->writeRegister(&Rd53b::GcrDefaultConfigB, 0x538A);
-    while(!hw->isCmdEmpty());
+    batch.write_register(fe, &Rd53b::GcrDefaultConfig, 0xAC75);
+    batch.write_register(fe, &Rd53b::GcrDefaultConfigB, 0x538A);
 
     // Send a global pulse to reset multiple things
     //logger->debug(" ... send resets via global pulse");
-    fe->writeRegister(&Rd53b::GlobalPulseConf, 0x0FFF);
-    fe->writeRegister(&Rd53b::GlobalPulseWidth, 10);
-    while(!hw->isCmdEmpty());
-    fe->sendGlobalPulse(fe->getChipId());
-    while(!hw->isCmdEmpty());
-    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    batch.write_register(fe, &Rd53b::GlobalPulseConf, 0x0FFF);
+    batch.write_register(fe, &Rd53b::GlobalPulseWidth, 10);
+    batch.global_pulse(chip_id);
+    batch.wait(std::chrono::microseconds(100));
     // Reset register
-    fe->writeRegister(&Rd53b::GlobalPulseConf, 0);
+    batch.write_register(fe, &Rd53b::GlobalPulseConf, 0);
 
     // Reset Core
     for (unsigned i=0; i<16; i++) {
-        fe->writeRegister(&Rd53b::RstCoreCol0, 1<<i);
-        fe->writeRegister(&Rd53b::RstCoreCol1, 1<<i);
-        fe->writeRegister(&Rd53b::RstCoreCol2, 1<<i);
-        fe->writeRegister(&Rd53b::RstCoreCol3, 1<<i);
-        fe->writeRegister(&Rd53b::EnCoreCol0, 1<<i);
-        fe->writeRegister(&Rd53b::EnCoreCol1, 1<<i);
-        fe->writeRegister(&Rd53b::EnCoreCol2, 1<<i);
-        fe->writeRegister(&Rd53b::EnCoreCol3, 1<<i);
-        while(!hw->isCmdEmpty()){;}
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
-        fe->sendClear(fe->getChipId());
-        while(!hw->isCmdEmpty()){;}
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        batch.write_register(fe, &Rd53b::RstCoreCol0, 1<<i);
+        batch.write_register(fe, &Rd53b::RstCoreCol1, 1<<i);
+        batch.write_register(fe, &Rd53b::RstCoreCol2, 1<<i);
+        batch.write_register(fe, &Rd53b::RstCoreCol3, 1<<i);
+        batch.write_register(fe, &Rd53b::EnCoreCol0, 1<<i);
+        batch.write_register(fe, &Rd53b::EnCoreCol1, 1<<i);
+        batch.write_register(fe, &Rd53b::EnCoreCol2, 1<<i);
+        batch.write_register(fe, &Rd53b::EnCoreCol3, 1<<i);
+        batch.wait(std::chrono::microseconds(100));
+        batch.clear(chip_id);
+        batch.wait(std::chrono::microseconds(100));
     }
 
     // Enable all for now, will be overwritten by global config
-    fe->writeRegister(&Rd53b::RstCoreCol0, 0xFFFF);
-    fe->writeRegister(&Rd53b::RstCoreCol1, 0xFFFF);
-    fe->writeRegister(&Rd53b::RstCoreCol2, 0xFFFF);
-    fe->writeRegister(&Rd53b::RstCoreCol3, 0x3F);
-    fe->writeRegister(&Rd53b::EnCoreCol0, 0xFFFF);
-    fe->writeRegister(&Rd53b::EnCoreCol1, 0xFFFF);
-    fe->writeRegister(&Rd53b::EnCoreCol2, 0xFFFF);
-    fe->writeRegister(&Rd53b::EnCoreCol3, 0x3F);
-    while(!hw->isCmdEmpty()){;}
+    batch.write_register(fe, &Rd53b::RstCoreCol0, 0xFFFF);
+    batch.write_register(fe, &Rd53b::RstCoreCol1, 0xFFFF);
+    batch.write_register(fe, &Rd53b::RstCoreCol2, 0xFFFF);
+    batch.write_register(fe, &Rd53b::RstCoreCol3, 0x3F);
+    batch.write_register(fe, &Rd53b::EnCoreCol0, 0xFFFF);
+    batch.write_register(fe, &Rd53b::EnCoreCol1, 0xFFFF);
+    batch.write_register(fe, &Rd53b::EnCoreCol2, 0xFFFF);
+    batch.write_register(fe, &Rd53b::EnCoreCol3, 0x3F);
 
     // Send a clear cmd
-    fe->sendClear(fe->getChipId());
-    while(!hw->isCmdEmpty());
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
+    batch.clear(chip_id);
 }
 
 void rd53b::helpers::configure_global(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe) {
@@ -276,6 +254,38 @@ void rd53b::helpers::configure_global(std::unique_ptr<SpecController>& hw, std::
     //while(!hw->isCmdEmpty());
 }
 
+void rd53b::helpers::configure_global(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe,
+                                      rd53b::command::GlobalShadow& shadow) {
+    shadow.invalidate();
+    configure_diff(hw, fe, shadow);
+}
+
+size_t rd53b::helpers::configure_diff(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe,
+                                      rd53b::command::GlobalShadow& shadow) {
+    // same order and pacing as Rd53b::configureGlobal: a pause after the
+    // preamp bias (register 13), at most 20 registers per burst
+    rd53b::command::CommandBatch batch(20 * 4);
+    uint32_t chip_id = fe->getChipId();
+    size_t n_written = 0;
+    for (uint32_t address = 0; address < rd53b::command::GlobalShadow::n_registers; address++) {
+        uint16_t value = rd53b::command::register_word(*fe, address);
+        if (shadow.holds(address, value)) continue;
+        batch.write_register(chip_id, address, value);
+        shadow.record(address, value);
+        n_written++;
+        if (address == 13) batch.wait(std::chrono::microseconds(100));
+    }
+    try {
+        batch.send(hw);
+        rd53b::wait::cmd_empty(hw);
+    } catch (...) {
+        // what made it to the chip is unknown
+        shadow.invalidate();
+        throw;
+    }
+    return n_written;
+}
+
 void rd53b::helpers::configure_pixels(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe) {
     fe->configurePixels();
     //// Setup pixel programming
@@ -304,6 +314,13 @@ void rd53b::helpers::rd53b_configure(std::unique_ptr<SpecController>& hw, std::u
 
 }
 
+void rd53b::helpers::rd53b_configure(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe,
+                                     rd53b::command::GlobalShadow& shadow) {
+    rd53b::helpers::configure_init(hw, fe);
+    rd53b::helpers::configure_global(hw, fe, shadow);
+    rd53b::helpers::configure_pixels(hw, fe);
+}
+
 bool rd53b::helpers::rd53b_reset(std::unique_ptr<SpecController>& hw,
                                  std::unique_ptr<Rd53b>& fe) {
     std::cout << "Resetting RD53B..." << std::endl;
@@ -319,8 +336,7 @@ bool rd53b::helpers::rd53b_reset(std::unique_ptr<SpecController>& hw,
         hw->writeFifo(0x00000000);
     }  // i
     hw->releaseFifo();
-    while (!hw->isCmdEmpty()) {
-    }
+    rd53b::wait::cmd_empty(hw);
 
     std::this_thread::sleep_for(std::chrono::milliseconds(20));
 
@@ -330,8 +346,7 @@ bool rd53b::helpers::rd53b_reset(std::unique_ptr<SpecController>& hw,
         hw->writeFifo(0x817e817e);
     }  // i
     hw->releaseFifo();
-    while (!hw->isCmdEmpty()) {
-    }
+    rd53b::wait::cmd_empty(hw);
 
     return true;
 }
@@ -346,26 +361,44 @@ bool rd53b::helpers::disable_pixels(std::unique_ptr<Rd53b>& fe) {
         }  // row
     }      // col
     fe->configurePixels();
+    return true;
+}
+
+size_t rd53b::helpers::disable_pixels(std::unique_ptr<SpecController>& hw,
+                                      std::unique_ptr<Rd53b>& fe,
+                                      rd53b::command::PixelShadow& pixels) {
+    pixels.fill(false, false, false);
+    return pixels.upload(hw, *fe);
 }
 
-void rd53b::helpers::set_core_columns(std::unique_ptr<Rd53b>& fe,
+void rd53b::helpers::set_core_columns(rd53b::command::CommandBatch& batch,
+                                      Rd53b& fe,
+                                      std::array<uint16_t, 4> cores,
+                                      rd53b::command::GlobalShadow* shadow) {
+    batch.write_register(fe, &Rd53b::EnCoreCol0, cores[0], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreCol1, cores[1], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreCol2, cores[2], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreCol3, cores[3], shadow);
+    batch.write_register(fe, &Rd53b::RstCoreCol0, cores[0], shadow);
+    batch.write_register(fe, &Rd53b::RstCoreCol1, cores[1], shadow);
+    batch.write_register(fe, &Rd53b::RstCoreCol2, cores[2], shadow);
+    batch.write_register(fe, &Rd53b::RstCoreCol3, cores[3], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreColCal0, cores[0], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreColCal1, cores[1], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreColCal2, cores[2], shadow);
+    batch.write_register(fe, &Rd53b::EnCoreColCal3, cores[3], shadow);
+    batch.write_register(fe, &Rd53b::HitOrMask0, ~cores[0], shadow);
+    batch.write_register(fe, &Rd53b::HitOrMask1, ~cores[1], shadow);
+    batch.write_register(fe, &Rd53b::HitOrMask2, ~cores[2], shadow);
+    batch.write_register(fe, &Rd53b::HitOrMask3, ~cores[3], shadow);
+}
+
+void rd53b::helpers::set_core_columns(std::unique_ptr<SpecController>& hw,
+                                      std::unique_ptr<Rd53b>& fe,
                                       std::array<uint16_t, 4> cores) {
-    fe->writeRegister(&Rd53b::EnCoreCol0, cores[0]);
-    fe->writeRegister(&Rd53b::EnCoreCol1, cores[1]);
-    fe->writeRegister(&Rd53b::EnCoreCol2, cores[2]);
-    fe->writeRegister(&Rd53b::EnCoreCol3, cores[3]);
-    fe->writeRegister(&Rd53b::RstCoreCol0, cores[0]);
-    fe->writeRegister(&Rd53b::RstCoreCol1, cores[1]);
-    fe->writeRegister(&Rd53b::RstCoreCol2, cores[2]);
-    fe->writeRegister(&Rd53b::RstCoreCol3, cores[3]);
-    fe->writeRegister(&Rd53b::EnCoreColCal0, cores[0]);
-    fe->writeRegister(&Rd53b::EnCoreColCal1, cores[1]);
-    fe->writeRegister(&Rd53b::EnCoreColCal2, cores[2]);
-    fe->writeRegister(&Rd53b::EnCoreColCal3, cores[3]);
-    fe->writeRegister(&Rd53b::HitOrMask0,~cores[0]);
-    fe->writeRegister(&Rd53b::HitOrMask1,~cores[1]);
-    fe->writeRegister(&Rd53b::HitOrMask2,~cores[2]);
-    fe->writeRegister(&Rd53b::HitOrMask3,~cores[3]);
+    rd53b::command::CommandBatch batch;
+    set_core_columns(batch, *fe, cores);
+    batch.send(hw);
 }
 
 bool rd53b::helpers::clear_tot_memories(std::unique_ptr<SpecController>& hw,
@@ -378,8 +411,7 @@ bool rd53b::helpers::clear_tot_memories(std::unique_ptr<SpecController>& hw,
 
     fe->configure();
     std::this_thread::sleep_for(std::chrono::microseconds(100));
-    while (!hw->isCmdEmpty()) {
-    }
+    rd53b::wait::cmd_empty(hw);
 
     hw->flushBuffer();
     hw->setCmdEnable(cfg->getTxChannel());
@@ -392,11 +424,12 @@ bool rd53b::helpers::clear_tot_memories(std::unique_ptr<SpecController>& hw,
     /////////////////////////////////
     json pre_scan_cfg = {{"InjDigEn", 1}, {"Latency", 500}};
     hw->setCmdEnable(cfg->getTxChannel());
+    rd53b::command::CommandBatch batch;
     for (auto j : pre_scan_cfg.items()) {
-        fe->writeNamedRegister(j.key(), j.value());
-    }
-    while (!hw->isCmdEmpty()) {
+        batch.write_named_register(*fe, j.key(), j.value());
     }
+    batch.send(hw);
+    rd53b::wait::cmd_empty(hw);
 
     // disable pixels
     rd53b::helpers::disable_pixels(fe);
@@ -446,14 +479,12 @@ bool rd53b::helpers::clear_tot_memories(std::unique_ptr<SpecController>& hw,
     //                           static_cast<float>(total_n_pixels))
     //                 << " %)";
     fe->configurePixels();
-    while (!hw->isCmdEmpty()) {
-    }
+    rd53b::wait::cmd_empty(hw);
 
     // core column loop
     std::array<uint16_t, 4> cores = {0x0, 0x0, 0x0, 0x0};
-    set_core_columns(fe, cores);
-    while (!hw->isCmdEmpty()) {
-    }
+    set_core_columns(hw, fe, cores);
+    rd53b::wait::cmd_empty(hw);
 
     unsigned int m_minCore = 0;
     unsigned int m_maxCore = 50;
@@ -461,15 +492,11 @@ bool rd53b::helpers::clear_tot_memories(std::unique_ptr<SpecController>& hw,
     unsigned int coreStep = 1;
     const uint32_t one = 0x1;
 
-    json trig_config = {{"trigMultiplier", 16},
-                        {"count", 1000},
-                        {"delay", 56},
-                        {"extTrigger", false},
-                        {"frequency", 800000},
-                        {"noInject", false},
-                        {"time", 0},
-                        {"edgeMode", true},
-                        {"edgeDuration", 2}};
+    rd53b::trigger::TriggerConfig trig_config;
+    trig_config.count = 1000;
+    trig_config.frequency = 800000;
+    // only the first step programs the trigger logic
+    rd53b::trigger::TriggerLoader trig_loader;
 
     // begin scan
     for (unsigned int m_cur = m_minCore; m_cur < m_maxCore; m_cur += coreStep) {
@@ -480,14 +507,12 @@ bool rd53b::helpers::clear_tot_memories(std::unique_ptr<SpecController>& hw,
             }
         }  // i
         hw->setCmdEnable(cfg->getTxChannel());
-        set_core_columns(fe, cores);
-        while (!hw->isCmdEmpty()) {
-        }
+        set_core_columns(hw, fe, cores);
+        rd53b::wait::cmd_empty(hw);
 
-        spec_init_trigger(hw, trig_config);
-        while (!hw->isCmdEmpty()) {
-        }
-        spec_trigger_loop(hw);
+        spec_init_trigger(hw, trig_config, trig_loader);
+        rd53b::wait::cmd_empty(hw);
+        spec_trigger_loop(hw, trig_config);
     }  // m_cur
 
     hw->disableCmd();
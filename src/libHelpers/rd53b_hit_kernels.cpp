@@ -0,0 +1,161 @@
+#include "rd53b_hit_kernels.h"
+
+// yarr
+#include "LUT_PlainHMapToColRow.h"
+
+// std/stl
+#include <cstdlib>  // getenv
+#include <cstring>  // strcmp
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+struct Kernel {
+    rd53b::decoder::ExpandHitsFn fn;
+    const char* name;
+};
+
+Kernel select_kernel() {
+    using namespace rd53b::decoder;
+    const char* forced = std::getenv("ITKPIX_HIT_KERNEL");
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    bool has_sse4 = __builtin_cpu_supports("sse4.1");
+    if (forced && std::strcmp(forced, "scalar") == 0) return {expand_hits_scalar, "scalar"};
+    if (forced && std::strcmp(forced, "sse4") == 0 && has_sse4) return {expand_hits_sse4, "sse4"};
+    if (has_avx2) return {expand_hits_avx2, "avx2"};
+    if (has_sse4) return {expand_hits_sse4, "sse4"};
+#else
+    (void)forced;
+#endif
+    return {expand_hits_scalar, "scalar"};
+}
+
+const Kernel& kernel() {
+    static const Kernel k = select_kernel();
+    return k;
+}
+};  // namespace
+
+rd53b::decoder::ExpandHitsFn rd53b::decoder::expand_hits_kernel() {
+    return kernel().fn;
+}
+
+const char* rd53b::decoder::expand_hits_kernel_name() { return kernel().name; }
+
+size_t rd53b::decoder::expand_hits_scalar(uint16_t hitmap, uint64_t tot_field,
+                                          uint16_t col_base, uint16_t row_base,
+                                          bool keep_all, uint16_t* col,
+                                          uint16_t* row, uint8_t* tot,
+                                          uint16_t* ptot_ptoa) {
+    using namespace RD53BDecoding;
+    unsigned n_tots = _LUT_PlainHMap_To_ColRow_ArrSize[hitmap];
+    size_t n_kept = 0;
+    for (unsigned ihit = 0; ihit < n_tots; ihit++) {
+        uint8_t pix_tot = (tot_field >> (ihit << 2)) & 0xf;
+        uint8_t col_row = _LUT_PlainHMap_To_ColRow[hitmap][ihit];
+        col[n_kept] = col_base + (col_row >> 4);
+        row[n_kept] = row_base + (col_row & 0xF);
+        tot[n_kept] = pix_tot;
+        ptot_ptoa[n_kept] = 0;
+        n_kept += (keep_all || pix_tot > 0);
+    }  // ihit
+    return n_kept;
+}
+
+#if defined(__x86_64__)
+
+//
+// The LUT row of a hitmap holds the (col << 4 | row) of its hits in 16
+// bytes and the ToT field holds their ToT in 16 nibbles, so a quarter core
+// is a byte-wise split of one vector for the addresses, and a nibble
+// interleave of one 64-bit word for the ToTs. Quarter cores in which a
+// ToT is 0 need their hits compacted, which is left to the scalar kernel:
+// a ToT of 0 is not expected in the data the chip sends.
+//
+
+__attribute__((target("sse4.1")))
+size_t rd53b::decoder::expand_hits_sse4(uint16_t hitmap, uint64_t tot_field,
+                                        uint16_t col_base, uint16_t row_base,
+                                        bool keep_all, uint16_t* col,
+                                        uint16_t* row, uint8_t* tot,
+                                        uint16_t* ptot_ptoa) {
+    using namespace RD53BDecoding;
+    unsigned n_tots = _LUT_PlainHMap_To_ColRow_ArrSize[hitmap];
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i t = _mm_cvtsi64_si128(static_cast<long long>(tot_field));
+    __m128i tots = _mm_unpacklo_epi8(_mm_and_si128(t, nibble),
+                                     _mm_and_si128(_mm_srli_epi16(t, 4), nibble));
+    if (!keep_all) {
+        uint32_t lanes = (1u << n_tots) - 1;
+        uint32_t zero = _mm_movemask_epi8(_mm_cmpeq_epi8(tots, _mm_setzero_si128()));
+        if (zero & lanes) {
+            return expand_hits_scalar(hitmap, tot_field, col_base, row_base,
+                                      keep_all, col, row, tot, ptot_ptoa);
+        }
+    }
+
+    __m128i col_row = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(_LUT_PlainHMap_To_ColRow[hitmap]));
+    __m128i cols = _mm_and_si128(_mm_srli_epi16(col_row, 4), nibble);
+    __m128i rows = _mm_and_si128(col_row, nibble);
+    __m128i vcol_base = _mm_set1_epi16(col_base);
+    __m128i vrow_base = _mm_set1_epi16(row_base);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(col),
+                     _mm_add_epi16(_mm_cvtepu8_epi16(cols), vcol_base));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(col + 8),
+                     _mm_add_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(cols, 8)), vcol_base));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row),
+                     _mm_add_epi16(_mm_cvtepu8_epi16(rows), vrow_base));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(row + 8),
+                     _mm_add_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(rows, 8)), vrow_base));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(tot), tots);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptot_ptoa), _mm_setzero_si128());
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptot_ptoa + 8), _mm_setzero_si128());
+    return n_tots;
+}
+
+__attribute__((target("avx2")))
+size_t rd53b::decoder::expand_hits_avx2(uint16_t hitmap, uint64_t tot_field,
+                                        uint16_t col_base, uint16_t row_base,
+                                        bool keep_all, uint16_t* col,
+                                        uint16_t* row, uint8_t* tot,
+                                        uint16_t* ptot_ptoa) {
+    using namespace RD53BDecoding;
+    unsigned n_tots = _LUT_PlainHMap_To_ColRow_ArrSize[hitmap];
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i t = _mm_cvtsi64_si128(static_cast<long long>(tot_field));
+    __m128i tots = _mm_unpacklo_epi8(_mm_and_si128(t, nibble),
+                                     _mm_and_si128(_mm_srli_epi16(t, 4), nibble));
+    if (!keep_all) {
+        uint32_t lanes = (1u << n_tots) - 1;
+        uint32_t zero = _mm_movemask_epi8(_mm_cmpeq_epi8(tots, _mm_setzero_si128()));
+        if (zero & lanes) {
+            return expand_hits_scalar(hitmap, tot_field, col_base, row_base,
+                                      keep_all, col, row, tot, ptot_ptoa);
+        }
+    }
+
+    __m128i col_row = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(_LUT_PlainHMap_To_ColRow[hitmap]));
+    __m128i cols = _mm_and_si128(_mm_srli_epi16(col_row, 4), nibble);
+    __m128i rows = _mm_and_si128(col_row, nibble);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(col),
+                        _mm256_add_epi16(_mm256_cvtepu8_epi16(cols),
+                                         _mm256_set1_epi16(col_base)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(row),
+                        _mm256_add_epi16(_mm256_cvtepu8_epi16(rows),
+                                         _mm256_set1_epi16(row_base)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(tot), tots);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptot_ptoa), _mm256_setzero_si256());
+    return n_tots;
+}
+
+#endif
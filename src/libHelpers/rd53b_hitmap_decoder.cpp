@@ -0,0 +1,30 @@
+#include "rd53b_hitmap_decoder.h"
+
+// yarr
+#include "LUT_BinaryTreeRowHMap.h"
+#include "LUT_BinaryTreeHitMap.h"
+
+const rd53b::decoder::HitmapDecoder& rd53b::decoder::HitmapDecoder::instance() {
+    static const HitmapDecoder decoder;
+    return decoder;
+}
+
+rd53b::decoder::HitmapDecoder::HitmapDecoder() {
+    using namespace RD53BDecoding;
+    for (uint32_t peek = 0; peek < (1 << 16); peek++) {
+        uint32_t entry = _LUT_BinaryTreeHitMap[peek];
+        uint8_t rollback_second = (entry >> 24) & 0xff;
+        if (rollback_second == 0) {
+            uint32_t len = 16 - ((entry >> 16) & 0xff);
+            m_first[peek] = (entry & 0xffff) | (len << 16);
+        } else {
+            uint32_t len = rollback_second == 0xff ? 16 : 16 - rollback_second;
+            m_first[peek] = (entry & 0xff) | (len << 16) | (1u << 24);
+        }
+    }
+    for (uint32_t peek = 0; peek < (1 << 14); peek++) {
+        uint16_t entry = _LUT_BinaryTreeRowHMap[peek];
+        uint16_t len = 14 - ((entry >> 8) & 0xff);
+        m_second[peek] = (entry & 0xff) | (len << 8);
+    }
+}
@@ -0,0 +1,128 @@
+#include "rd53b_metrics.h"
+
+// std/stl
+#include <fstream>
+#include <map>
+#include <memory>  // unique_ptr
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<rd53b::metrics::Counter>> counters;
+    std::map<std::string, std::unique_ptr<rd53b::metrics::Histogram>> histograms;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+uint64_t bucket_upper_edge(unsigned ibucket) {
+    if (ibucket == 0) return 0;
+    if (ibucket == 64) return UINT64_MAX;
+    return (uint64_t(1) << ibucket) - 1;
+}
+};  // namespace
+
+uint64_t rd53b::metrics::Histogram::quantile(double q) const {
+    uint64_t n_total = n();
+    if (n_total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * n_total);
+    if (rank >= n_total) rank = n_total - 1;
+    uint64_t n_seen = 0;
+    for (unsigned ibucket = 0; ibucket < n_buckets; ibucket++) {
+        n_seen += m_buckets[ibucket].load(std::memory_order_relaxed);
+        if (n_seen > rank) {
+            return std::min(bucket_upper_edge(ibucket), m_max.load(std::memory_order_relaxed));
+        }
+    }
+    return m_max.load(std::memory_order_relaxed);
+}
+
+void rd53b::metrics::Histogram::reset() {
+    for (auto& bucket : m_buckets) bucket = 0;
+    m_n = 0;
+    m_sum = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+}
+
+json rd53b::metrics::Histogram::to_json() const {
+    json j;
+    uint64_t n_total = n();
+    j["unit"] = m_unit;
+    j["n"] = n_total;
+    j["sum"] = sum();
+    j["min"] = n_total ? m_min.load(std::memory_order_relaxed) : 0;
+    j["max"] = m_max.load(std::memory_order_relaxed);
+    j["mean"] = n_total ? static_cast<double>(sum()) / n_total : 0.;
+    j["p50"] = quantile(0.50);
+    j["p90"] = quantile(0.90);
+    j["p99"] = quantile(0.99);
+    // non-empty buckets, by upper edge
+    json buckets = json::object();
+    for (unsigned ibucket = 0; ibucket < n_buckets; ibucket++) {
+        uint64_t count = m_buckets[ibucket].load(std::memory_order_relaxed);
+        if (count) buckets[std::to_string(bucket_upper_edge(ibucket))] = count;
+    }
+    j["buckets"] = buckets;
+    return j;
+}
+
+rd53b::metrics::Counter& rd53b::metrics::counter(const std::string& name) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto& c = r.counters[name];
+    if (!c) c.reset(new Counter());
+    return *c;
+}
+
+rd53b::metrics::Histogram& rd53b::metrics::histogram(const std::string& name,
+                                                     const std::string& unit) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto& h = r.histograms[name];
+    if (!h) h.reset(new Histogram(unit));
+    return *h;
+}
+
+void rd53b::metrics::reset() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (auto& c : r.counters) c.second->reset();
+    for (auto& h : r.histograms) h.second->reset();
+    r.start = std::chrono::steady_clock::now();
+}
+
+json rd53b::metrics::summary() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - r.start).count();
+    json j;
+    j["instrumented"] = enabled;
+    j["elapsed_s"] = elapsed;
+    json counters = json::object();
+    for (const auto& c : r.counters) {
+        uint64_t count = c.second->count();
+        counters[c.first]["count"] = count;
+        counters[c.first]["rate_per_s"] = elapsed > 0 ? count / elapsed : 0.;
+    }
+    j["counters"] = counters;
+    json histograms = json::object();
+    for (const auto& h : r.histograms) {
+        histograms[h.first] = h.second->to_json();
+    }
+    j["histograms"] = histograms;
+    return j;
+}
+
+void rd53b::metrics::write_summary(const std::string& filename) {
+    std::ofstream ofs(filename);
+    if (!ofs.good()) {
+        throw std::runtime_error("Unable to open metrics file: " + filename);
+    }
+    ofs << summary().dump(4) << std::endl;
+}
@@ -0,0 +1,169 @@
+#include "rd53b_parallel_decoder.h"
+
+// std/stl
+#include <algorithm>  // max, min
+#include <thread>
+#include <utility>  // move
+
+namespace {
+// chunks per thread to aim for, so that stealing can even out the load
+const size_t chunks_per_thread = 16;
+// below this many blocks a chunk is not worth scheduling on its own
+const size_t min_chunk_blocks = 4096;
+};  // namespace
+
+rd53b::decoder::ParallelDecoder::ParallelDecoder(unsigned n_threads,
+                                                 bool drop_tot,
+                                                 bool do_compressed_hitmap,
+                                                 bool use_ptot, bool resilient)
+    : m_n_threads(n_threads > 0 ? n_threads
+                                : std::max(1u, std::thread::hardware_concurrency())),
+      m_drop_tot(drop_tot),
+      m_do_compressed_hitmap(do_compressed_hitmap),
+      m_use_ptot(use_ptot),
+      m_resilient(resilient) {
+    for (unsigned ithread = 0; ithread < m_n_threads; ithread++) {
+        m_queues.emplace_back(new WorkQueue());
+    }
+}
+
+void rd53b::decoder::ParallelDecoder::make_chunks(size_t n_blocks_total) {
+    size_t chunk_blocks = std::max(min_chunk_blocks,
+                                   n_blocks_total / (m_n_threads * chunks_per_thread));
+    size_t n_chunks = 0;
+    for (uint8_t ch_id = 0; ch_id < n_channels; ch_id++) {
+        const auto& streams = m_streams[ch_id];
+        size_t istream = 0;
+        while (istream < streams.size()) {
+            if (n_chunks == m_chunks.size()) {
+                m_chunks.emplace_back();
+            }
+            Chunk& chunk = m_chunks[n_chunks++];
+            chunk.chip_id = ch_id;
+            chunk.first_stream = istream;
+            chunk.events.clear();
+            chunk.errors.clear();
+            size_t n_blocks = 0;
+            while (istream < streams.size() && n_blocks < chunk_blocks) {
+                n_blocks += streams[istream++].blocks.size();
+            }
+            chunk.n_streams = istream - chunk.first_stream;
+        }
+    }
+    m_chunks.resize(n_chunks);
+
+    // each thread gets a contiguous share of the chunks
+    for (unsigned ithread = 0; ithread < m_n_threads; ithread++) {
+        auto& queue = *m_queues[ithread];
+        queue.chunks.clear();
+        size_t begin = n_chunks * ithread / m_n_threads;
+        size_t end = n_chunks * (ithread + 1) / m_n_threads;
+        for (size_t ichunk = begin; ichunk < end; ichunk++) {
+            queue.chunks.push_back(ichunk);
+        }
+    }
+}
+
+bool rd53b::decoder::ParallelDecoder::next_chunk(unsigned ithread,
+                                                 size_t& ichunk) {
+    {
+        auto& own = *m_queues[ithread];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.chunks.empty()) {
+            ichunk = own.chunks.front();
+            own.chunks.pop_front();
+            return true;
+        }
+    }
+    for (unsigned i = 1; i < m_n_threads; i++) {
+        auto& victim = *m_queues[(ithread + i) % m_n_threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.chunks.empty()) {
+            ichunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            m_n_steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void rd53b::decoder::ParallelDecoder::work(unsigned ithread) {
+    try {
+        size_t ichunk = 0;
+        while (!m_abort.load(std::memory_order_relaxed) && next_chunk(ithread, ichunk)) {
+            Chunk& chunk = m_chunks[ichunk];
+            const auto& streams = m_streams[chunk.chip_id];
+            for (size_t i = 0; i < chunk.n_streams; i++) {
+                const Stream& stream = streams[chunk.first_stream + i];
+                if (m_resilient) {
+                    decode_stream(stream, chunk.events, chunk.errors, m_drop_tot,
+                                  m_do_compressed_hitmap, m_use_ptot);
+                } else {
+                    decode_stream(stream, chunk.events, m_drop_tot,
+                                  m_do_compressed_hitmap, m_use_ptot);
+                }
+            }
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_error_mutex);
+        if (!m_error) m_error = std::current_exception();
+        m_abort = true;
+    }
+}
+
+void rd53b::decoder::ParallelDecoder::decode(BlockSpan blocks,
+                                             uint8_t channel_mask) {
+    for (auto& events : m_events) events.clear();
+    for (auto& errors : m_errors) errors.clear();
+    m_n_blocks = {0, 0, 0, 0};
+    m_n_streams = {0, 0, 0, 0};
+    m_abort = false;
+    m_n_steals = 0;
+    m_error = nullptr;
+
+    auto stream_map = build_streams(blocks, m_storage, /*keep_last*/ true);
+    size_t n_blocks_total = 0;
+    for (unsigned ch_id = 0; ch_id < n_channels; ch_id++) {
+        m_streams[ch_id].clear();
+        auto it = stream_map.find(ch_id);
+        if (it == stream_map.end()) continue;
+        for (const auto& stream : it->second) {
+            m_n_blocks[ch_id] += stream.blocks.size();
+        }
+        m_n_streams[ch_id] = it->second.size();
+        if ((channel_mask >> ch_id) & 0x1) {
+            m_streams[ch_id] = std::move(it->second);
+            n_blocks_total += m_n_blocks[ch_id];
+        }
+    }
+    make_chunks(n_blocks_total);
+
+    // the calling thread is worker 0
+    std::vector<std::thread> threads;
+    for (unsigned ithread = 1; ithread < m_n_threads; ithread++) {
+        threads.emplace_back(&ParallelDecoder::work, this, ithread);
+    }
+    work(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+
+    // chunks are in capture order within each channel
+    std::array<size_t, n_channels> n_hits = {0, 0, 0, 0};
+    std::array<size_t, n_channels> n_events = {0, 0, 0, 0};
+    for (const auto& chunk : m_chunks) {
+        n_hits[chunk.chip_id] += chunk.events.n_hits();
+        n_events[chunk.chip_id] += chunk.events.n_events();
+    }
+    for (unsigned ch_id = 0; ch_id < n_channels; ch_id++) {
+        m_events[ch_id].reserve(n_hits[ch_id], n_events[ch_id]);
+    }
+    for (const auto& chunk : m_chunks) {
+        m_events[chunk.chip_id].append(chunk.events);
+        m_errors[chunk.chip_id] += chunk.errors;
+    }
+}
@@ -0,0 +1,160 @@
+#include "rd53b_pixel_shadow.h"
+#include "rd53b_metrics.h"
+#include "rd53b_wait.h"
+
+// std/stl
+#include <algorithm>  // min
+#include <stdexcept>
+#include <string>
+
+namespace {
+// both pixels of a register are in adjacent bits, never across words
+const uint64_t even_bits = 0x5555555555555555ull;
+};  // namespace
+
+rd53b::command::PixelShadow::PixelShadow(Rd53b& fe, bool uploaded) {
+    for (auto& bits : m_bits) bits.assign(n_words, 0);
+    for (auto& bits : m_uploaded) bits.assign(n_words, 0);
+    load(fe);
+    if (uploaded) {
+        m_uploaded = m_bits;
+        m_known = true;
+    }
+}
+
+void rd53b::command::PixelShadow::load(Rd53b& fe) {
+    for (unsigned row = 0; row < n_row; row++) {
+        for (unsigned col = 0; col < n_col; col++) {
+            size_t i = index(col, row);
+            assign(m_bits[0], i, fe.getEn(col, row));
+            assign(m_bits[1], i, fe.getInjEn(col, row));
+            assign(m_bits[2], i, fe.getHitbus(col, row));
+        }
+    }
+}
+
+void rd53b::command::PixelShadow::set_uploaded(Rd53b& fe) {
+    load(fe);
+    m_uploaded = m_bits;
+    m_known = true;
+}
+
+void rd53b::command::PixelShadow::assign(Bitset& bits, size_t i, bool value) {
+    uint64_t mask = uint64_t(1) << (i % 64);
+    if (value) {
+        bits[i / 64] |= mask;
+    } else {
+        bits[i / 64] &= ~mask;
+    }
+}
+
+void rd53b::command::PixelShadow::assign_range(Bitset& bits, size_t begin,
+                                               size_t end, bool value) {
+    while (begin < end) {
+        size_t iword = begin / 64;
+        size_t first = begin % 64;
+        size_t last = std::min<size_t>(64, first + (end - begin));
+        uint64_t mask = (last - first == 64) ? ~uint64_t(0)
+                                             : ((uint64_t(1) << (last - first)) - 1) << first;
+        if (value) {
+            bits[iword] |= mask;
+        } else {
+            bits[iword] &= ~mask;
+        }
+        begin += last - first;
+    }
+}
+
+void rd53b::command::PixelShadow::set(unsigned col, unsigned row, bool enable,
+                                      bool inject, bool hitbus) {
+    if (col >= n_col || row >= n_row) {
+        throw std::out_of_range("Pixel out of range: (col, row) = (" + std::to_string(col) +
+                                ", " + std::to_string(row) + ")");
+    }
+    size_t i = index(col, row);
+    assign(m_bits[0], i, enable);
+    assign(m_bits[1], i, inject);
+    assign(m_bits[2], i, hitbus);
+}
+
+void rd53b::command::PixelShadow::fill(bool enable, bool inject, bool hitbus) {
+    fill_columns(0, n_col, enable, inject, hitbus);
+}
+
+void rd53b::command::PixelShadow::fill_columns(unsigned col_begin, unsigned col_end,
+                                               bool enable, bool inject,
+                                               bool hitbus) {
+    col_end = std::min(col_end, n_col);
+    if (col_begin >= col_end) return;
+    // whole rows at once when all columns are filled
+    size_t n_rows_span = (col_begin == 0 && col_end == n_col) ? 1 : n_row;
+    size_t span = (col_begin == 0 && col_end == n_col) ? n_pixels : col_end - col_begin;
+    for (size_t row = 0; row < n_rows_span; row++) {
+        size_t begin = index(col_begin, row);
+        assign_range(m_bits[0], begin, begin + span, enable);
+        assign_range(m_bits[1], begin, begin + span, inject);
+        assign_range(m_bits[2], begin, begin + span, hitbus);
+    }
+}
+
+size_t rd53b::command::PixelShadow::n_dirty() const {
+    if (!m_known) return n_registers;
+    size_t n = 0;
+    for (size_t iword = 0; iword < n_words; iword++) {
+        uint64_t diff = (m_bits[0][iword] ^ m_uploaded[0][iword]) |
+                        (m_bits[1][iword] ^ m_uploaded[1][iword]) |
+                        (m_bits[2][iword] ^ m_uploaded[2][iword]);
+        n += __builtin_popcountll((diff | (diff >> 1)) & even_bits);
+    }
+    return n;
+}
+
+size_t rd53b::command::PixelShadow::upload(std::unique_ptr<SpecController>& hw,
+                                           Rd53b& fe) {
+    size_t n = n_dirty();
+    if (n == 0) return 0;
+
+    // a register write per dirty register takes three commands (region
+    // column, region row, portal) against about one per register for the
+    // auto-row upload of the whole matrix
+    bool full = !m_known || 3 * n > n_registers;
+    std::vector<std::pair<unsigned, unsigned>> pixels;
+    if (!full) pixels.reserve(n);
+    for (size_t iword = 0; iword < n_words; iword++) {
+        uint64_t diff = full ? ~uint64_t(0)
+                             : (m_bits[0][iword] ^ m_uploaded[0][iword]) |
+                                   (m_bits[1][iword] ^ m_uploaded[1][iword]) |
+                                   (m_bits[2][iword] ^ m_uploaded[2][iword]);
+        diff = (diff | (diff >> 1)) & even_bits;
+        while (diff) {
+            size_t i = iword * 64 + __builtin_ctzll(diff);
+            diff &= diff - 1;
+            if (i >= n_pixels) break;
+            unsigned row = i / n_col;
+            unsigned col = i % n_col;
+            for (unsigned c = col; c < col + 2; c++) {
+                size_t ipix = i + (c - col);
+                fe.setEn(c, row, test(m_bits[0], ipix));
+                fe.setInjEn(c, row, test(m_bits[1], ipix));
+                fe.setHitbus(c, row, test(m_bits[2], ipix));
+            }
+            if (!full) pixels.emplace_back(col, row);
+        }
+    }
+
+    try {
+        if (full) {
+            fe.configurePixels();
+        } else {
+            fe.configurePixels(pixels);
+        }
+        rd53b::wait::cmd_empty(hw);
+    } catch (...) {
+        m_known = false;
+        throw;
+    }
+    m_uploaded = m_bits;
+    m_known = true;
+    RD53B_METRICS_COUNT("pixel_shadow.registers", full ? n_registers : n);
+    return full ? n_registers : n;
+}
@@ -0,0 +1,84 @@
+#include "rd53b_rate_monitor.h"
+
+// std/stl
+#include <algorithm>  // max
+
+json rd53b::readout::RateSample::to_json() const {
+    return {{"elapsed_s", elapsed_s},
+            {"interval_s", interval_s},
+            {"configured_trigger_rate", configured_trigger_rate},
+            {"tag_rate", tag_rate},
+            {"event_rate", event_rate},
+            {"hit_rate", hit_rate},
+            {"word_rate", word_rate},
+            {"efficiency", efficiency},
+            {"data_loss", data_loss},
+            {"words", counts.n_words},
+            {"tags", counts.n_tags},
+            {"events", counts.n_events},
+            {"hits", counts.n_hits},
+            {"errors", counts.n_errors},
+            {"ring_full", counts.n_ring_full}};
+}
+
+rd53b::readout::RateMonitor::RateMonitor(double trigger_frequency,
+                                         unsigned triggers_per_pulse,
+                                         std::chrono::milliseconds interval,
+                                         double min_efficiency)
+    : m_configured_trigger_rate(trigger_frequency * triggers_per_pulse),
+      m_interval(interval),
+      m_min_efficiency(min_efficiency) {
+    start();
+}
+
+void rd53b::readout::RateMonitor::start() {
+    m_start = clock::now();
+    m_last_time = m_start;
+    m_last_counts = RateCounts();
+    m_last = RateSample();
+    m_n_samples = 0;
+    m_n_lossy_samples = 0;
+    m_max_sustained_rate = 0;
+}
+
+rd53b::readout::RateSample rd53b::readout::RateMonitor::sample(
+    const RateCounts& begin, const RateCounts& end, clock::time_point t_begin,
+    clock::time_point t_end) const {
+    RateSample s;
+    s.elapsed_s = std::chrono::duration<double>(t_end - m_start).count();
+    s.interval_s = std::chrono::duration<double>(t_end - t_begin).count();
+    s.counts = end;
+    if (s.interval_s <= 0) return s;
+    s.configured_trigger_rate = m_configured_trigger_rate;
+    s.tag_rate = (end.n_tags - begin.n_tags) / s.interval_s;
+    s.event_rate = (end.n_events - begin.n_events) / s.interval_s;
+    s.hit_rate = (end.n_hits - begin.n_hits) / s.interval_s;
+    s.word_rate = (end.n_words - begin.n_words) / s.interval_s;
+    s.efficiency =
+        m_configured_trigger_rate > 0 ? s.tag_rate / m_configured_trigger_rate : 0;
+    s.data_loss = end.n_errors != begin.n_errors ||
+                  end.n_ring_full != begin.n_ring_full ||
+                  s.efficiency < m_min_efficiency;
+    return s;
+}
+
+bool rd53b::readout::RateMonitor::update(const RateCounts& counts) {
+    auto now = clock::now();
+    if (now - m_last_time < m_interval) return false;
+    m_last = sample(m_last_counts, counts, m_last_time, now);
+    m_last_time = now;
+    m_last_counts = counts;
+    m_n_samples++;
+    if (m_last.data_loss) {
+        m_n_lossy_samples++;
+    } else {
+        m_max_sustained_rate =
+            std::max(m_max_sustained_rate, m_last.configured_trigger_rate);
+    }
+    return true;
+}
+
+rd53b::readout::RateSample rd53b::readout::RateMonitor::total(
+    const RateCounts& counts) const {
+    return sample(RateCounts(), counts, m_start, clock::now());
+}
@@ -0,0 +1,116 @@
+#include "rd53b_readout.h"
+#include "rd53b_metrics.h"
+#include "rd53b_wait.h"
+
+// std/stl
+#include <utility>  // move
+
+namespace {
+// waiting for data, readData() and isTrigDone() being PCIe register
+// reads: as rd53b::wait, with the sleeps kept short so that a burst of
+// data is picked up before the DMA buffers fill
+const rd53b::wait::Backoff idle_backoff = {16, 16, std::chrono::microseconds(10),
+                                           std::chrono::microseconds(100)};
+};  // namespace
+
+rd53b::readout::ReadoutThread::ReadoutThread(
+    std::unique_ptr<SpecController>& hw, size_t ring_capacity)
+    : m_hw(hw), m_ring(ring_capacity) {}
+
+rd53b::readout::ReadoutThread::~ReadoutThread() { stop(); }
+
+void rd53b::readout::ReadoutThread::start() {
+    if (m_thread.joinable()) return;
+    m_stop = false;
+    m_stop_requested = false;
+    m_finished = false;
+    m_thread = std::thread(&ReadoutThread::run, this);
+}
+
+void rd53b::readout::ReadoutThread::stop() {
+    m_stop = true;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool rd53b::readout::ReadoutThread::try_next(std::unique_ptr<RawData>& data) {
+    return m_ring.try_pop(data);
+}
+
+bool rd53b::readout::ReadoutThread::next(std::unique_ptr<RawData>& data) {
+    rd53b::wait::IdleBackoff idle(idle_backoff);
+    while (true) {
+        if (m_ring.try_pop(data)) return true;
+        if (finished()) {
+            // the drain thread may have pushed its last buffers between the
+            // pop above and setting the flag
+            if (m_ring.try_pop(data)) return true;
+            if (m_error) std::rethrow_exception(m_error);
+            return false;
+        }
+        idle.pause();
+    }
+}
+
+size_t rd53b::readout::ReadoutThread::drain() {
+    RD53B_METRICS_TIMER(timer, "readout.drain_ns");
+    size_t n_read = 0;
+    while (!m_stop) {
+        std::unique_ptr<RawData> data;
+        {
+            RD53B_METRICS_TIMER(read_timer, "readout.read_data_ns");
+            data.reset(m_hw->readData());
+        }
+        if (!data) break;
+        n_read++;
+        m_n_buffers.fetch_add(1, std::memory_order_relaxed);
+        m_n_words.fetch_add(data->words, std::memory_order_relaxed);
+        RD53B_METRICS_COUNT("readout.buffers", 1);
+        RD53B_METRICS_COUNT("readout.words", data->words);
+        RD53B_METRICS_RECORD("readout.buffer_words", "words", data->words);
+        if (!m_ring.try_push(std::move(data))) {
+            m_n_ring_full.fetch_add(1, std::memory_order_relaxed);
+            RD53B_METRICS_TIMER(full_timer, "readout.ring_full_wait_ns");
+            while (!m_ring.try_push(std::move(data))) {
+                if (m_stop) break;
+                std::this_thread::yield();
+            }
+            if (data) {
+                // stopped with the consumer no longer reading
+                m_n_dropped.fetch_add(1, std::memory_order_relaxed);
+                RD53B_METRICS_COUNT("readout.dropped_buffers", 1);
+                break;
+            }
+        }
+        size_t depth = m_ring.size();
+        RD53B_METRICS_RECORD("readout.ring_depth", "buffers", depth);
+        if (depth > m_max_ring_depth.load(std::memory_order_relaxed)) {
+            m_max_ring_depth.store(depth, std::memory_order_relaxed);
+        }
+    }
+    return n_read;
+}
+
+void rd53b::readout::ReadoutThread::run() {
+    try {
+        rd53b::wait::IdleBackoff idle(idle_backoff);
+        while (!m_stop && !m_stop_requested) {
+            bool done = m_hw->isTrigDone();
+            size_t n_read = drain();
+            if (done) break;
+            if (n_read == 0) {
+                idle.pause();
+            } else {
+                idle.reset();
+            }
+        }
+        if (!m_stop) {
+            std::this_thread::sleep_for(m_hw->getWaitTime());
+            drain();
+        }
+    } catch (...) {
+        m_error = std::current_exception();
+    }
+    m_finished.store(true, std::memory_order_release);
+}
@@ -0,0 +1,10 @@
+#include "rd53b_register_shadow.h"
+#include "rd53b_command_batch.h"  // register_word
+
+size_t rd53b::command::GlobalShadow::n_dirty(const Rd53b& fe) const {
+    size_t n = 0;
+    for (uint32_t address = 0; address < n_registers; address++) {
+        if (!holds(address, register_word(fe, address))) n++;
+    }
+    return n;
+}
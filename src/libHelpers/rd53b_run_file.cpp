@@ -0,0 +1,184 @@
+#include "rd53b_run_file.h"
+
+// std/stl
+#include <cerrno>
+#include <cstring>  // memcmp, memcpy, strerror
+#include <stdexcept>
+#include <vector>
+
+// posix
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char run_file_magic[8] = {'R', 'D', '5', '3', 'B', 'R', 'U', 'N'};
+const size_t fixed_header_size = 28;
+
+// RunHeader flags
+const uint8_t flag_compressed_hitmap = 0x1;
+const uint8_t flag_drop_tot = 0x2;
+const uint8_t flag_use_ptot = 0x4;
+
+std::string system_error(const std::string& what, const std::string& filename) {
+    return what + " \"" + filename + "\": " + std::strerror(errno);
+}
+};  // namespace
+
+uint8_t rd53b::io::RunHeader::channel_mask() const {
+    uint8_t mask = 0;
+    for (unsigned ch_id = 0; ch_id < 4; ch_id++) {
+        if (chip_ids[ch_id] != no_chip) mask |= (1 << ch_id);
+    }
+    return mask;
+}
+
+rd53b::io::RunFileWriter::RunFileWriter(const std::string& filename,
+                                        const RunHeader& header)
+    : m_filename(filename) {
+    m_out.open(filename, std::ios::binary | std::ios::trunc);
+    if (!m_out) {
+        throw std::runtime_error(system_error("Unable to open run file", filename));
+    }
+
+    std::string trigger_config =
+        header.trigger_config.is_null() ? "" : header.trigger_config.dump();
+    uint32_t trigger_config_len = trigger_config.size();
+    uint32_t data_offset = (fixed_header_size + trigger_config_len + 7) / 8 * 8;
+    uint8_t flags = (header.compressed_hitmap ? flag_compressed_hitmap : 0) |
+                    (header.drop_tot ? flag_drop_tot : 0) |
+                    (header.use_ptot ? flag_use_ptot : 0);
+
+    std::vector<char> buf(data_offset, 0);
+    uint32_t version = RunHeader::version;
+    std::memcpy(&buf[0], run_file_magic, sizeof(run_file_magic));
+    std::memcpy(&buf[8], &version, sizeof(version));
+    std::memcpy(&buf[12], &data_offset, sizeof(data_offset));
+    std::memcpy(&buf[16], header.chip_ids.data(), header.chip_ids.size());
+    buf[20] = static_cast<char>(flags);
+    std::memcpy(&buf[24], &trigger_config_len, sizeof(trigger_config_len));
+    std::memcpy(&buf[fixed_header_size], trigger_config.data(), trigger_config_len);
+    m_out.write(buf.data(), buf.size());
+}
+
+rd53b::io::RunFileWriter::~RunFileWriter() {
+    if (m_out.is_open()) {
+        m_out.close();
+    }
+}
+
+void rd53b::io::RunFileWriter::write_blocks(const uint64_t* blocks,
+                                            size_t n_blocks) {
+    m_out.write(reinterpret_cast<const char*>(blocks), n_blocks * sizeof(uint64_t));
+    if (!m_out) {
+        throw std::runtime_error(system_error("Unable to write to run file", m_filename));
+    }
+    m_n_blocks += n_blocks;
+}
+
+void rd53b::io::RunFileWriter::write_words(const uint32_t* words,
+                                           size_t n_words) {
+    // pair the words into blocks in chunks, to keep the writes large
+    const size_t chunk_size = 512;
+    uint64_t chunk[chunk_size];
+    size_t n = 0;
+    size_t i = 0;
+    if (m_has_pending_word && n_words > 0) {
+        // the first word of a block is its 32 MS bits
+        chunk[n++] = (static_cast<uint64_t>(m_pending_word) << 32) | words[0];
+        m_has_pending_word = false;
+        i = 1;
+    }
+    for (; i + 1 < n_words; i += 2) {
+        chunk[n++] = (static_cast<uint64_t>(words[i]) << 32) | words[i + 1];
+        if (n == chunk_size) {
+            write_blocks(chunk, n);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        write_blocks(chunk, n);
+    }
+    if (i < n_words) {
+        m_pending_word = words[i];
+        m_has_pending_word = true;
+    }
+}
+
+void rd53b::io::RunFileWriter::close() {
+    m_out.close();
+    if (!m_out) {
+        throw std::runtime_error(system_error("Unable to close run file", m_filename));
+    }
+}
+
+rd53b::io::RunFileReader::RunFileReader(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(system_error("Unable to open run file", filename));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error(system_error("Unable to stat run file", filename));
+    }
+    m_map_size = st.st_size;
+    if (m_map_size < fixed_header_size) {
+        ::close(fd);
+        throw std::runtime_error("Run file \"" + filename + "\" is too short to hold a header");
+    }
+    m_map = ::mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m_map == MAP_FAILED) {
+        m_map = nullptr;
+        throw std::runtime_error(system_error("Unable to map run file", filename));
+    }
+    ::madvise(m_map, m_map_size, MADV_SEQUENTIAL);
+
+    auto bytes = static_cast<const char*>(m_map);
+    uint32_t version = 0;
+    uint32_t data_offset = 0;
+    uint32_t trigger_config_len = 0;
+    std::memcpy(&version, &bytes[8], sizeof(version));
+    std::memcpy(&data_offset, &bytes[12], sizeof(data_offset));
+    std::memcpy(&trigger_config_len, &bytes[24], sizeof(trigger_config_len));
+    if (std::memcmp(bytes, run_file_magic, sizeof(run_file_magic)) != 0 ||
+        version != RunHeader::version || data_offset % 8 != 0 ||
+        data_offset > m_map_size ||
+        fixed_header_size + trigger_config_len > data_offset) {
+        ::munmap(m_map, m_map_size);
+        m_map = nullptr;
+        throw std::runtime_error("File \"" + filename + "\" is not a valid run file (version " +
+                                 std::to_string(RunHeader::version) + ")");
+    }
+
+    std::memcpy(m_header.chip_ids.data(), &bytes[16], m_header.chip_ids.size());
+    uint8_t flags = bytes[20];
+    m_header.compressed_hitmap = flags & flag_compressed_hitmap;
+    m_header.drop_tot = flags & flag_drop_tot;
+    m_header.use_ptot = flags & flag_use_ptot;
+    if (trigger_config_len > 0) {
+        try {
+            m_header.trigger_config = json::parse(std::string(
+                &bytes[fixed_header_size], trigger_config_len));
+        } catch (std::exception& e) {
+            // the destructor does not run for a throwing constructor
+            ::munmap(m_map, m_map_size);
+            m_map = nullptr;
+            throw std::runtime_error("Run file \"" + filename +
+                                     "\" has an invalid trigger configuration: " + e.what());
+        }
+    }
+
+    // the mapping is page aligned and the blocks start at a multiple of 8,
+    // a trailing partial block (run cut short mid-write) is ignored
+    m_blocks.ptr = reinterpret_cast<const uint64_t*>(bytes + data_offset);
+    m_blocks.len = (m_map_size - data_offset) / sizeof(uint64_t);
+}
+
+rd53b::io::RunFileReader::~RunFileReader() {
+    if (m_map) {
+        ::munmap(m_map, m_map_size);
+    }
+}
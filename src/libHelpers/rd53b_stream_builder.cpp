@@ -0,0 +1,34 @@
+#include "rd53b_stream_builder.h"
+#include "rd53b_metrics.h"
+
+// std/stl
+#include <utility>  // move
+
+rd53b::decoder::StreamBuilder::StreamBuilder(Callback on_stream,
+                                             uint8_t channel_mask)
+    : m_demux(std::move(on_stream), channel_mask) {}
+
+void rd53b::decoder::StreamBuilder::push(const uint32_t* words,
+                                         size_t n_words) {
+    RD53B_METRICS_TIMER(timer, "stream_builder.push_ns");
+    RD53B_METRICS_COUNT("stream_builder.words", n_words);
+    size_t i = 0;
+    if (m_has_pending_word && n_words > 0) {
+        // the first word of a block is its 32 MS bits
+        push_block((static_cast<uint64_t>(m_pending_word) << 32) | words[0]);
+        m_has_pending_word = false;
+        i = 1;
+    }
+    for (; i + 1 < n_words; i += 2) {
+        push_block((static_cast<uint64_t>(words[i]) << 32) | words[i + 1]);
+    }
+    if (i < n_words) {
+        m_pending_word = words[i];
+        m_has_pending_word = true;
+    }
+}
+
+void rd53b::decoder::StreamBuilder::reset() {
+    m_demux.reset();
+    m_has_pending_word = false;
+}
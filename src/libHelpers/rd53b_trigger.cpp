@@ -0,0 +1,235 @@
+#include "rd53b_trigger.h"
+#include "rd53b_metrics.h"
+#include "rd53b_wait.h"
+
+// yarr
+#include "Rd53b.h"
+
+// std/stl
+#include <algorithm>  // max
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>  // move, pair
+
+namespace {
+// the trigger pulse is shifted by up to 7 bunch crossings in a 64-bit stream
+const uint32_t max_multiplier = 56;
+
+// (delay, multiplier, edge duration)
+using WordsKey = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+// the trigger commands, as generated by Rd53b::genTrigger, of every
+// pattern of bunch crossings and trigger tag: (pattern, tag)
+const std::map<uint16_t, std::pair<uint8_t, uint8_t>>& trigger_commands() {
+    static const std::map<uint16_t, std::pair<uint8_t, uint8_t>> commands = [] {
+        std::map<uint16_t, std::pair<uint8_t, uint8_t>> m;
+        for (uint8_t pattern = 1; pattern < 16; pattern++) {
+            for (uint8_t tag = 0; tag < 54; tag++) {
+                m[Rd53b::genTrigger(pattern, tag)[0]] = {pattern, tag};
+            }
+        }
+        return m;
+    }();
+    return commands;
+}
+
+rd53b::trigger::TriggerWords encode(const rd53b::trigger::TriggerConfig& config) {
+    rd53b::trigger::TriggerWords words;
+    words.fill(0xaaaaaaaa);
+
+    ////////////////////////////////////////////////////////////////
+    // SET TRIGGER DELAY
+    ////////////////////////////////////////////////////////////////
+    uint64_t trigStream = 0;
+
+    uint64_t one = 1;
+    for (unsigned i = 0; i < config.multiplier; i++) {
+        trigStream |= (one << i);
+    }  // i
+    trigStream = trigStream << config.delay % 8;
+
+    for (unsigned i = 0; i < (config.multiplier / 8) + 1; i++) {
+        if (((30 - (config.delay / 8) - i) > 2) && config.delay > 30) {
+            uint32_t bc1 = (trigStream >> (2 * i * 4)) & 0xf;
+            uint32_t bc2 = (trigStream >> ((2 * i * 4) + 4)) & 0xf;
+            words[30 - (config.delay / 8) - i] =
+                ((uint32_t)Rd53b::genTrigger(bc1, 2 * i)[0] << 16) |
+                Rd53b::genTrigger(bc2, (2 * i) + 1)[0];
+        } else {
+            std::cout << "Delay is either too small or too large!" << std::endl;
+        }
+    }  // i
+
+    // rearm
+    std::array<uint16_t, 3> armWords = Rd53b::genCal(16, 1, 0, 0, 0, 0);
+    words[1] = 0xaaaa0000 | armWords[0];
+    words[0] = ((uint32_t)armWords[1] << 16) | armWords[2];
+
+    ////////////////////////////////////////////////////////////////
+    // SET EDGE MODE
+    ////////////////////////////////////////////////////////////////
+    std::array<uint16_t, 3> calWords = Rd53b::genCal(16, 1, 0, config.edge_duration, 0, 0);
+    words[31] = 0xaaaa0000 | calWords[0];
+    words[30] = ((uint32_t)calWords[1] << 16) | calWords[2];
+    return words;
+}
+};  // namespace
+
+rd53b::trigger::TriggerConfig rd53b::trigger::TriggerConfig::from_json(
+    const json& trigger_config) {
+    TriggerConfig config;
+    std::string mode = trigger_config.value("mode", std::string("count"));
+    if (mode == "count") {
+        config.mode = INT_COUNT;
+    } else if (mode == "time") {
+        config.mode = INT_TIME;
+    } else {
+        throw std::runtime_error("Unsupported trigger mode: \"" + mode +
+                                 "\" (\"count\" or \"time\")");
+    }
+    config.count = trigger_config.at("count");
+    config.delay = trigger_config.at("delay");
+    config.multiplier = trigger_config.value("trigMultiplier", 16u);
+    config.frequency = trigger_config.at("frequency");
+    config.time = trigger_config.at("time");
+    config.no_inject = trigger_config.at("noInject");
+    config.edge_mode = trigger_config.at("edgeMode");
+    config.ext_trigger = trigger_config.at("extTrigger");
+    config.edge_duration = trigger_config.at("edgeDuration");
+    if (config.multiplier > max_multiplier) {
+        throw std::runtime_error("Unsupported trigger multiplier: " +
+                                 std::to_string(config.multiplier) + " (at most " +
+                                 std::to_string(max_multiplier) + ")");
+    }
+    return config;
+}
+
+bool rd53b::trigger::TriggerConfig::operator==(const TriggerConfig& other) const {
+    return mode == other.mode && count == other.count && delay == other.delay &&
+           multiplier == other.multiplier && frequency == other.frequency &&
+           time == other.time && no_inject == other.no_inject &&
+           edge_mode == other.edge_mode && ext_trigger == other.ext_trigger &&
+           edge_duration == other.edge_duration;
+}
+
+const rd53b::trigger::TriggerWords& rd53b::trigger::trigger_words(
+    const TriggerConfig& config) {
+    // std::map never moves its elements: references handed out stay valid
+    static std::mutex mutex;
+    static std::map<WordsKey, TriggerWords> cache;
+
+    WordsKey key{config.delay, config.multiplier, config.edge_duration};
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        RD53B_METRICS_COUNT("trigger.words_encoded", 1);
+        it = cache.emplace(key, encode(config)).first;
+    }
+    return it->second;
+}
+
+std::vector<uint16_t> rd53b::trigger::event_tags(const uint32_t* words, size_t n_words) {
+    const auto& commands = trigger_commands();
+    std::vector<uint16_t> tags;
+    for (size_t i = n_words; i-- > 0;) {
+        for (uint16_t frame : {static_cast<uint16_t>(words[i] >> 16),
+                               static_cast<uint16_t>(words[i] & 0xffff)}) {
+            auto it = commands.find(frame);
+            if (it == commands.end()) continue;
+            uint8_t pattern = it->second.first;
+            uint8_t tag = it->second.second;
+            for (unsigned ibc = 0; ibc < 4; ibc++) {
+                if ((pattern >> (3 - ibc)) & 0x1) {
+                    tags.push_back((tag << 2) | ibc);
+                }
+            }
+        }
+    }
+    return tags;
+}
+
+std::vector<uint16_t> rd53b::trigger::event_tags(const TriggerConfig& config) {
+    const TriggerWords& words = trigger_words(config);
+    return event_tags(words.data(), words.size());
+}
+
+unsigned rd53b::trigger::TriggerLoader::load(std::unique_ptr<SpecController>& hw,
+                                             const TriggerConfig& config) {
+    RD53B_METRICS_TIMER(timer, "trigger.init_ns");
+    bool full = (m_hw != hw.get());
+    unsigned n_written = 0;
+
+    ////////////////////////////////////////////////////////////////
+    // SET TRIGGER MODE
+    ////////////////////////////////////////////////////////////////
+    if (full || config.mode != m_config.mode) {
+        hw->setTrigConfig(config.mode);
+        n_written++;
+    }
+    if (!config.timed() && (full || config.count != m_config.count)) {
+        hw->setTrigCnt(config.count);
+        n_written++;
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // REMAINING
+    ////////////////////////////////////////////////////////////////
+    if (full || config.frequency != m_config.frequency) {
+        hw->setTrigFreq(config.frequency);
+        n_written++;
+    }
+    if (full || &trigger_words(config) != &trigger_words(m_config)) {
+        // setTrigWord takes a non-const pointer
+        TriggerWords words = trigger_words(config);
+        hw->setTrigWord(&words[0], words.size());
+        n_written++;
+    }
+    if (full) {
+        hw->setTrigWordLength(std::tuple_size<TriggerWords>::value);
+        n_written++;
+    }
+    if (full || config.time != m_config.time) {
+        hw->setTrigTime(config.time);
+        n_written++;
+    }
+
+    m_hw = hw.get();
+    m_config = config;
+    RD53B_METRICS_COUNT("trigger.settings_written", n_written);
+    return n_written;
+}
+
+std::chrono::milliseconds rd53b::trigger::done_timeout(const TriggerConfig& config) {
+    if (config.ext_trigger || config.frequency <= 0) return rd53b::wait::no_timeout;
+    double run_time_s = config.timed() ? config.time : config.count / config.frequency;
+    auto expected = std::chrono::milliseconds(static_cast<int64_t>(1e3 * 1.1 * run_time_s)) +
+                    std::chrono::seconds(10);
+    return std::max<std::chrono::milliseconds>(expected, rd53b::wait::default_trigger_timeout);
+}
+
+rd53b::trigger::TagGaps::TagGaps(std::vector<uint16_t> expected)
+    : m_expected(std::move(expected)) {}
+
+void rd53b::trigger::TagGaps::push(uint16_t tag) {
+    m_n_received++;
+    size_t n = m_expected.size();
+    for (size_t skip = 0; skip < n; skip++) {
+        size_t i = (m_next + skip) % n;
+        if ((m_expected[i] & 0xff) == (tag & 0xff)) {
+            m_n_missing += skip;
+            m_next = (i + 1) % n;
+            return;
+        }
+    }
+    m_n_unexpected++;
+}
+
+void rd53b::trigger::TagGaps::finish(uint64_t n_pulses) {
+    uint64_t n_expected = n_pulses * m_expected.size();
+    uint64_t n_seen = m_n_received - m_n_unexpected + m_n_missing;
+    if (n_expected > n_seen) m_n_missing += n_expected - n_seen;
+}
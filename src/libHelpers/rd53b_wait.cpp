@@ -0,0 +1,30 @@
+#include "rd53b_wait.h"
+#include "rd53b_metrics.h"
+
+// std/stl
+#include <stdexcept>
+#include <string>
+
+uint64_t rd53b::wait::cmd_empty(std::unique_ptr<SpecController>& hw,
+                                std::chrono::milliseconds timeout) {
+    Result result = poll_until([&hw]() { return hw->isCmdEmpty(); }, timeout);
+    RD53B_METRICS_COUNT("wait.cmd_empty.polls", result.n_polls);
+    RD53B_METRICS_RECORD("wait.cmd_empty_ns", "ns", result.elapsed.count());
+    if (!result.done) {
+        throw std::runtime_error("Timed out after " + std::to_string(timeout.count()) +
+                                 " ms waiting for the command FIFO to empty");
+    }
+    return result.n_polls;
+}
+
+uint64_t rd53b::wait::trig_done(std::unique_ptr<SpecController>& hw,
+                                std::chrono::milliseconds timeout) {
+    Result result = poll_until([&hw]() { return hw->isTrigDone(); }, timeout);
+    RD53B_METRICS_COUNT("wait.trig_done.polls", result.n_polls);
+    RD53B_METRICS_RECORD("wait.trig_done_ns", "ns", result.elapsed.count());
+    if (!result.done) {
+        throw std::runtime_error("Timed out after " + std::to_string(timeout.count()) +
+                                 " ms waiting for the trigger logic to be done");
+    }
+    return result.n_polls;
+}
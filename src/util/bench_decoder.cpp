@@ -0,0 +1,316 @@
+//std/stl
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>  // malloc, free
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+//YARR
+#include "logging.h"
+
+//itkpix_dataflow
+#include "rd53b_decoder.h"
+#include "rd53b_encoder.h"
+#include "rd53b_event_buffer.h"
+#include "rd53b_hit_kernels.h"
+
+#define LOGGER(x) spdlog::x
+
+//
+// count every heap allocation, to report allocations per decoded stream
+//
+namespace {
+std::atomic<size_t> n_allocations{0};
+};  // namespace
+
+void* operator new(size_t size) {
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return ::operator new(size); }
+void* operator new(size_t size, std::align_val_t align) {
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t alignment = static_cast<size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t align) { return ::operator new(size, align); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+struct option longopts_t[] = {{"streams", required_argument, NULL, 'n'},
+                              {"events", required_argument, NULL, 'e'},
+                              {"repeat", required_argument, NULL, 'r'},
+                              {"filter", required_argument, NULL, 'f'},
+                              {"seed", required_argument, NULL, 's'},
+                              {"help", no_argument, NULL, 'h'},
+                              {0, 0, 0, 0}};
+
+void print_help() {
+    std::cout << "=========================================================="
+              << std::endl;
+	std::cout << " RD53B decoder benchmark on synthetic streams" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Usage: [CMD] [OPTIONS]" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Options:" << std::endl;
+    std::cout << "   -n|--streams  number of streams per chip and case [default: 2000]" << std::endl;
+    std::cout << "   -e|--events   number of events per stream [default: 1]" << std::endl;
+    std::cout << "   -r|--repeat   number of timed passes over the streams [default: 5]" << std::endl;
+    std::cout << "   -f|--filter   only run the cases whose name contains this string" << std::endl;
+    std::cout << "   -s|--seed     random seed [default: 1]" << std::endl;
+    std::cout << "   -h|--help     print this help message" << std::endl;
+    std::cout << "=========================================================="
+              << std::endl;
+}
+
+namespace {
+
+const unsigned n_cols = 400;
+const unsigned n_rows = 384;
+
+// how the pixels of an event are hit
+struct Profile {
+    std::string name;
+    double occupancy;  // per pixel, when > 0
+    bool single_pixel;
+    bool core_column;
+};
+
+struct Case {
+    std::string name;
+    bool compressed_hitmap;
+    bool drop_tot;
+    bool use_ptot;
+    Profile profile;
+    unsigned n_chips;
+};
+
+void generate_event(const Case& c, uint16_t tag, std::mt19937_64& rng,
+                    rd53b::decoder::EventBuffer& events,
+                    std::vector<uint32_t>& pixels) {
+    events.begin_event(tag);
+    std::uniform_int_distribution<unsigned> tot(1, 15);
+    std::uniform_int_distribution<unsigned> ccol(0, n_cols / 8 - 1);
+    uint8_t no_tot = 0;
+
+    if (c.use_ptot) {
+        // PToT records report per hit bus, 4 per core column
+        std::uniform_int_distribution<uint16_t> ptot_ptoa(0, 0xffff);
+        if (c.profile.single_pixel) {
+            events.add_hit(ccol(rng) * 8 + rng() % 4, 0, no_tot, ptot_ptoa(rng));
+        } else if (c.profile.core_column) {
+            unsigned col_base = ccol(rng) * 8;
+            for (unsigned ibus = 0; ibus < 4; ibus++) {
+                events.add_hit(col_base + ibus, 0, no_tot, ptot_ptoa(rng));
+            }
+        } else {
+            std::bernoulli_distribution bus_hit(
+                std::min(1.0, c.profile.occupancy * 8 * n_rows / 4));
+            for (unsigned col_base = 0; col_base < n_cols; col_base += 8) {
+                for (unsigned ibus = 0; ibus < 4; ibus++) {
+                    if (bus_hit(rng)) events.add_hit(col_base + ibus, 0, no_tot, ptot_ptoa(rng));
+                }
+            }
+        }
+        return;
+    }
+
+    pixels.clear();
+    if (c.profile.single_pixel) {
+        pixels.push_back(rng() % (n_cols * n_rows));
+    } else if (c.profile.core_column) {
+        unsigned col_base = ccol(rng) * 8;
+        for (unsigned row = 0; row < n_rows; row++) {
+            for (unsigned col = col_base; col < col_base + 8; col++) {
+                pixels.push_back(row * n_cols + col);
+            }
+        }
+    } else {
+        std::binomial_distribution<unsigned> n_hits(n_cols * n_rows, c.profile.occupancy);
+        for (unsigned n = n_hits(rng); n > 0; n--) {
+            pixels.push_back(rng() % (n_cols * n_rows));
+        }
+        std::sort(pixels.begin(), pixels.end());
+        pixels.erase(std::unique(pixels.begin(), pixels.end()), pixels.end());
+    }
+    for (auto p : pixels) {
+        events.add_hit(p % n_cols, p / n_cols, c.drop_tot ? no_tot : tot(rng));
+    }
+}
+
+struct Result {
+    size_t n_streams = 0;
+    size_t n_blocks = 0;
+    size_t n_hits = 0;
+    double seconds = 0;
+    size_t n_allocations = 0;
+    bool hits_match = true;
+};
+
+Result run_case(const Case& c, unsigned n_streams, unsigned n_events_per_stream,
+                unsigned n_repeat, std::mt19937_64& rng) {
+    namespace rd = rd53b::decoder;
+
+    // encode the streams of each chip, then interleave the chips block by
+    // block as on a merged link and split them again
+    rd53b::encoder::StreamEncoder encoder(c.compressed_hitmap, c.drop_tot, c.use_ptot);
+    std::vector<std::vector<uint64_t>> chip_blocks(c.n_chips);
+    std::vector<uint32_t> pixels;
+    size_t n_hits_expected = 0;
+    for (unsigned ichip = 0; ichip < c.n_chips; ichip++) {
+        rd::EventBuffer events;
+        for (unsigned istream = 0; istream < n_streams; istream++) {
+            events.clear();
+            for (unsigned ievent = 0; ievent < n_events_per_stream; ievent++) {
+                generate_event(c, (istream + ievent) & 0xff, rng, events, pixels);
+            }
+            n_hits_expected += events.n_hits();
+            encoder.encode(events, 0, events.n_events(), ichip, chip_blocks[ichip]);
+        }
+        // a last NS = 1 block closes the last stream
+        encoder.encode(events, 0, 1, ichip, chip_blocks[ichip]);
+    }
+    std::vector<uint64_t> blocks;
+    for (size_t iblock = 0;; iblock++) {
+        size_t n_added = 0;
+        for (const auto& cb : chip_blocks) {
+            if (iblock < cb.size()) {
+                blocks.push_back(cb[iblock]);
+                n_added++;
+            }
+        }
+        if (n_added == 0) break;
+    }
+    std::vector<uint64_t> storage;
+    auto stream_map = rd::build_streams(blocks, storage);
+    std::vector<rd::Stream> streams;
+    for (const auto& it : stream_map) {
+        streams.insert(streams.end(), it.second.begin(), it.second.end());
+    }
+
+    Result result;
+    result.n_streams = streams.size();
+    for (const auto& st : streams) result.n_blocks += st.blocks.size();
+
+    // one untimed pass to size the event buffer
+    rd::EventBuffer events;
+    size_t n_hits_decoded = 0;
+    for (const auto& st : streams) {
+        events.clear();
+        rd::decode_stream(st, events, c.drop_tot, c.compressed_hitmap, c.use_ptot);
+        n_hits_decoded += events.n_hits();
+    }
+    result.hits_match = n_hits_decoded == n_hits_expected;
+
+    size_t n_allocations_start = n_allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned irepeat = 0; irepeat < n_repeat; irepeat++) {
+        for (const auto& st : streams) {
+            events.clear();
+            rd::decode_stream(st, events, c.drop_tot, c.compressed_hitmap, c.use_ptot);
+            result.n_hits += events.n_hits();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.n_allocations = n_allocations.load() - n_allocations_start;
+    result.n_streams *= n_repeat;
+    result.n_blocks *= n_repeat;
+    return result;
+}
+
+};  // namespace
+
+int main(int argc, char* argv[]) {
+	std::string defaultLogPattern = "[%T:%e]%^[%=8l]:%$ %v";
+	spdlog::set_pattern(defaultLogPattern);
+
+    unsigned n_streams = 2000;
+    unsigned n_events_per_stream = 1;
+    unsigned n_repeat = 5;
+    std::string filter = "";
+    unsigned seed = 1;
+    int c;
+    while ((c = getopt_long(argc, argv, "n:e:r:f:s:h", longopts_t, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                n_streams = std::max(1, atoi(optarg));
+                break;
+            case 'e':
+                n_events_per_stream = std::max(1, atoi(optarg));
+                break;
+            case 'r':
+                n_repeat = std::max(1, atoi(optarg));
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 's':
+                seed = atoi(optarg);
+                break;
+            case 'h':
+                print_help();
+                return 0;
+                break;
+            case '?':
+            default:
+				LOGGER(error)("Invalid command-line argument provided: {}", char(c));
+                return 1;
+        }  // switch
+    }      // while
+
+    std::vector<Profile> profiles = {{"single", 0, true, false},
+                                     {"occ1e-4", 1e-4, false, false},
+                                     {"occ1e-3", 1e-3, false, false},
+                                     {"occ1e-2", 1e-2, false, false},
+                                     {"ccol", 0, false, true}};
+    std::vector<Case> cases;
+    for (bool compressed : {false, true}) {
+        for (unsigned readout = 0; readout < 3; readout++) {
+            bool drop_tot = readout == 1;
+            bool use_ptot = readout == 2;
+            for (const auto& profile : profiles) {
+                for (unsigned n_chips : {1, 4}) {
+                    std::string name = std::string(compressed ? "compressed" : "raw") +
+                                       (use_ptot ? "/ptot" : drop_tot ? "/notot" : "/tot") +
+                                       "/" + profile.name + "/chips" + std::to_string(n_chips);
+                    if (filter != "" && name.find(filter) == std::string::npos) continue;
+                    cases.push_back({name, compressed, drop_tot, use_ptot, profile, n_chips});
+                }
+            }
+        }
+    }
+
+    LOGGER(info)("{} streams per chip, {} events per stream, {} passes, {} hit kernel", n_streams, n_events_per_stream, n_repeat, rd53b::decoder::expand_hits_kernel_name());
+    LOGGER(info)("{:<32} {:>12} {:>12} {:>10} {:>12} {:>10}", "case", "blocks/s", "hits/s", "ns/hit", "hits/stream", "allocs/stream");
+    std::mt19937_64 rng(seed);
+    bool all_match = true;
+    for (const auto& bench_case : cases) {
+        Result r = run_case(bench_case, n_streams, n_events_per_stream, n_repeat, rng);
+        double ns_per_hit = r.n_hits > 0 ? r.seconds * 1e9 / r.n_hits : 0;
+        LOGGER(info)("{:<32} {:>12.4g} {:>12.4g} {:>10.3f} {:>12.1f} {:>10.3f}{}", bench_case.name,
+                r.n_blocks / r.seconds, r.n_hits / r.seconds, ns_per_hit,
+                double(r.n_hits) / r.n_streams, double(r.n_allocations) / r.n_streams,
+                r.hits_match ? "" : "  HIT COUNT MISMATCH");
+        all_match &= r.hits_match;
+    }
+    if (!all_match) {
+        LOGGER(error)("Decoded hits do not match the generated hits for some cases!");
+        return 1;
+    }
+
+    return 0;
+}
@@ -22,7 +22,9 @@ namespace fs = std::experimental::filesystem;
 #include "LUT_BinaryTreeHitMap.h"
 
 //itkpix_dataflow
+#include "rd53b_command_batch.h"
 #include "rd53b_helpers.h"
+#include "rd53b_wait.h"
 
 #define LOGGER(x) spdlog::x
 
@@ -34,28 +36,31 @@ struct option longopts_t[] = {{"hw", required_argument, NULL, 'r'},
 
 void wait(std::unique_ptr<SpecController>& hw) {
     std::this_thread::sleep_for(std::chrono::microseconds(100));
-    while(!hw->isCmdEmpty()) {}
+    rd53b::wait::cmd_empty(hw);
 }
 
 void send_reset(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe, unsigned signal) {
     LOGGER(info)("Sending reset signal to Chip {}: {:x}", fe->getChipId(), 0xffff & signal);
-    fe->writeRegister(&Rd53b::GlobalPulseConf, signal);
-    fe->writeRegister(&Rd53b::GlobalPulseWidth, 10);
-    wait(hw);
-    fe->sendGlobalPulse(fe->getChipId());
-    wait(hw);
-    fe->writeRegister(&Rd53b::GlobalPulseConf, 0);
+    rd53b::command::CommandBatch batch;
+    batch.write_register(*fe, &Rd53b::GlobalPulseConf, signal);
+    batch.write_register(*fe, &Rd53b::GlobalPulseWidth, 10);
+    batch.global_pulse(fe->getChipId());
+    batch.wait(std::chrono::microseconds(100));
+    batch.write_register(*fe, &Rd53b::GlobalPulseConf, 0);
+    batch.send(hw);
 }
 
-void set_cores(std::unique_ptr<Rd53b>& fe, std::array<uint16_t, 4> cores, bool use_ptot = false) {
+void set_cores(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe, std::array<uint16_t, 4> cores, bool use_ptot = false) {
     namespace rh = rd53b::helpers;
-    rh::set_core_columns(fe, cores);
+    rd53b::command::CommandBatch batch;
+    rh::set_core_columns(batch, *fe, cores);
     if(use_ptot) {
-        fe->writeRegister(&Rd53b::PtotCoreColEn0, cores[0]);
-        fe->writeRegister(&Rd53b::PtotCoreColEn1, cores[1]);
-        fe->writeRegister(&Rd53b::PtotCoreColEn2, cores[2]);
-        fe->writeRegister(&Rd53b::PtotCoreColEn3, cores[3]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn0, cores[0]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn1, cores[1]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn2, cores[2]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn3, cores[3]);
     }
+    batch.send(hw);
 }
 
 void set_pixels_enable(std::unique_ptr<Rd53b>& fe, std::vector<std::pair<unsigned, unsigned>> pixel_addresses, bool use_ptot = false) {
@@ -71,10 +76,12 @@ void set_pixels_enable(std::unique_ptr<Rd53b>& fe, std::vector<std::pair<unsigne
 }
 
 
-void write_config(const json& config, std::unique_ptr<Rd53b>& fe) {
+void write_config(std::unique_ptr<SpecController>& hw, const json& config, std::unique_ptr<Rd53b>& fe) {
+    rd53b::command::CommandBatch batch;
     for(auto j: config.items()) {
-        fe->writeNamedRegister(j.key(), j.value());
+        batch.write_named_register(*fe, j.key(), j.value());
     }
+    batch.send(hw);
 }
 
 void print_help() {
@@ -0,0 +1,184 @@
+//std/stl
+#include <iostream>
+#include <experimental/filesystem>
+#include <array>
+#include <chrono>
+#include <string>
+#include <getopt.h>
+namespace fs = std::experimental::filesystem;
+
+//YARR
+#include "logging.h"
+
+//itkpix_dataflow
+#include "rd53b_channel_demux.h"
+#include "rd53b_decoder.h"
+#include "rd53b_metrics.h"
+#include "rd53b_parallel_decoder.h"
+#include "rd53b_run_file.h"
+
+#define LOGGER(x) spdlog::x
+
+struct option longopts_t[] = {{"input", required_argument, NULL, 'i'},
+                              {"threads", required_argument, NULL, 'j'},
+                              {"metrics", required_argument, NULL, 'm'},
+                              {"debug", no_argument, NULL, 'd'},
+                              {"help", no_argument, NULL, 'h'},
+                              {0, 0, 0, 0}};
+
+void print_help() {
+    std::cout << "=========================================================="
+              << std::endl;
+	std::cout << " Decode a binary run file offline" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Usage: [CMD] [OPTIONS]" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Options:" << std::endl;
+    std::cout << "   -i|--input   binary run file to decode" << std::endl;
+    std::cout << "   -j|--threads number of decoding threads, 0 for one per core (default: 1)" << std::endl;
+    std::cout << "   -m|--metrics write the per-stage metrics to this JSON file [optional]" << std::endl;
+    std::cout << "   -d|--debug   turn on debug-level (prints every hit)" << std::endl;
+    std::cout << "   -h|--help    print this help message" << std::endl;
+    std::cout << "=========================================================="
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	std::string defaultLogPattern = "[%T:%e]%^[%=8l]:%$ %v";
+	spdlog::set_pattern(defaultLogPattern);
+
+    std::string input_filename = "";
+    unsigned n_threads = 1;
+    std::string metrics_filename = "";
+	bool verbose = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "i:j:m:dh", longopts_t, NULL)) != -1) {
+        switch (c) {
+            case 'i':
+                input_filename = optarg;
+                break;
+            case 'j':
+                n_threads = std::stoi(optarg);
+                break;
+            case 'm':
+                metrics_filename = optarg;
+                break;
+            case 'd':
+				verbose = true;
+                break;
+            case 'h':
+                print_help();
+                return 0;
+                break;
+            case '?':
+            default:
+				LOGGER(error)("Invalid command-line argument provided: {}", char(c));
+                return 1;
+        }  // switch
+    }      // while
+
+    if (!fs::exists(fs::path(input_filename))) {
+        LOGGER(error)("Provided run file (=\"{}\") does not exist!", input_filename);
+        return 1;
+    }
+    if(verbose) {
+        spdlog::set_level(spdlog::level::debug);
+    }
+
+    namespace rio = rd53b::io;
+    namespace rd = rd53b::decoder;
+    rio::RunFileReader run(input_filename);
+    const auto& header = run.header();
+    for(unsigned ch_id = 0; ch_id < 4; ch_id++) {
+        if(header.chip_ids[ch_id] != rio::RunHeader::no_chip) {
+            LOGGER(info)("CH ID LS[{}] = chip id {}", ch_id, header.chip_ids[ch_id]);
+        }
+    }
+    LOGGER(info)("Compressed hitmap: {}, drop ToT: {}, PToT: {}",
+            header.compressed_hitmap, header.drop_tot, header.use_ptot);
+    if(!header.trigger_config.is_null()) {
+        LOGGER(info)("Trigger config: {}", header.trigger_config.dump());
+    }
+    LOGGER(info)("Run file holds {} 64-bit blocks", run.blocks().size());
+
+    rd::EventBuffer events;
+    std::array<size_t, 4> n_events = {0, 0, 0, 0};
+    std::array<size_t, 4> n_hits = {0, 0, 0, 0};
+    std::array<size_t, 4> n_blocks = {0, 0, 0, 0};
+    std::array<size_t, 4> n_streams = {0, 0, 0, 0};
+    std::array<rd::DecodeErrors, 4> decode_errors;
+    auto print_events = [&](unsigned ch_id, const rd::EventBuffer& events) {
+        for(size_t ievent = 0; ievent < events.n_events(); ievent++) {
+            LOGGER(debug)("Chip {}, TAG: {}", ch_id, events.tag(ievent));
+            for(size_t h = events.hit_begin(ievent); h < events.hit_end(ievent); h++) {
+                LOGGER(debug)("    (col, row) = ({}, {}) -> ToT = {}, PToT = {}, PToA = {}", events.col()[h], events.row()[h], events.tot()[h], events.ptot(h), events.ptoa(h));
+            }
+        }
+    };
+
+    rd53b::metrics::reset();
+    auto start = std::chrono::steady_clock::now();
+    if(n_threads == 1) {
+        rd::ChannelDemux demux([&](const rd::Stream& stream) {
+            events.clear();
+            rd::decode_stream(stream, events, decode_errors[stream.chip_id], header.drop_tot, header.compressed_hitmap, header.use_ptot);
+            n_events[stream.chip_id] += events.n_events();
+            n_hits[stream.chip_id] += events.n_hits();
+            if(verbose) print_events(stream.chip_id, events);
+        }, header.channel_mask());
+        for(auto block : run.blocks()) {
+            demux.push(block);
+        }
+        demux.flush();
+        for(unsigned ch_id = 0; ch_id < 4; ch_id++) {
+            n_blocks[ch_id] = demux.counters(ch_id).n_blocks;
+            n_streams[ch_id] = demux.counters(ch_id).n_streams;
+        }
+    } else {
+        rd::ParallelDecoder decoder(n_threads, header.drop_tot, header.compressed_hitmap, header.use_ptot, /*resilient*/ true);
+        decoder.decode(run.blocks(), header.channel_mask());
+        LOGGER(info)("Decoded on {} threads: {} chunks, {} stolen", decoder.n_threads(),
+                decoder.n_chunks(), decoder.n_steals());
+        for(unsigned ch_id = 0; ch_id < 4; ch_id++) {
+            const auto& ch_events = decoder.events(ch_id);
+            n_blocks[ch_id] = decoder.n_blocks(ch_id);
+            n_streams[ch_id] = decoder.n_streams(ch_id);
+            n_events[ch_id] = ch_events.n_events();
+            n_hits[ch_id] = ch_events.n_hits();
+            decode_errors[ch_id] = decoder.errors(ch_id);
+            if(verbose) print_events(ch_id, ch_events);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    LOGGER(info)("-------------------------------------------------------------------");
+    for(unsigned ch_id = 0; ch_id < 4; ch_id++) {
+        if(n_blocks[ch_id] == 0) continue;
+        LOGGER(info)("CH ID LS[{}]: {} blocks, {} streams, {} events, {} hits{}", ch_id,
+                n_blocks[ch_id], n_streams[ch_id], n_events[ch_id], n_hits[ch_id],
+                ((header.channel_mask() >> ch_id) & 0x1) ? "" : " (unexpected chip, not decoded)");
+        const auto& errors = decode_errors[ch_id];
+        if(errors.total() > 0) {
+            LOGGER(warn)("    dropped {} corrupted streams:", errors.total());
+            for(unsigned ierror = 0; ierror < rd::n_decode_errors; ierror++) {
+                auto error = static_cast<rd::DecodeError>(ierror);
+                if(errors.count(error) == 0) continue;
+                LOGGER(warn)("        {}: {}", rd::to_string(error), errors.count(error));
+            }
+        }
+    }
+    double mbytes = run.blocks().size() * sizeof(uint64_t) / 1e6;
+    LOGGER(info)("Decoded {:.1f} MB in {:.3f} s ({:.1f} MB/s)", mbytes, seconds,
+            seconds > 0 ? mbytes / seconds : 0.0);
+
+    if(metrics_filename != "") {
+        if(!rd53b::metrics::enabled) {
+            LOGGER(warn)("Built without ITKPIX_INSTRUMENTATION, the metrics will be empty");
+        }
+        rd53b::metrics::write_summary(metrics_filename);
+        LOGGER(info)("Wrote the metrics to: {}", metrics_filename);
+    }
+
+    return 0;
+}
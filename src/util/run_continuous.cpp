@@ -0,0 +1,380 @@
+//std/stl
+#include <iostream>
+#include <experimental/filesystem>
+#include <atomic>
+#include <csignal>
+#include <memory>  // unique_ptr
+#include <string>
+#include <vector>
+#include <getopt.h>
+namespace fs = std::experimental::filesystem;
+
+//YARR
+#include "logging.h"
+#include "LoggingConfig.h"
+#include "Bookkeeper.h"
+#include "Rd53b.h"
+#include "ScanHelper.h"
+#include "SpecController.h"
+#include "RawData.h"
+
+//itkpix_dataflow
+#include "rd53b_command_batch.h"
+#include "rd53b_helpers.h"
+#include "rd53b_pixel_shadow.h"
+#include "rd53b_wait.h"
+#include "rd53b_decoder.h"
+#include "rd53b_metrics.h"
+#include "rd53b_rate_monitor.h"
+#include "rd53b_readout.h"
+#include "rd53b_stream_builder.h"
+#include "rd53b_trigger.h"
+
+#define LOGGER(x) spdlog::x
+
+struct option longopts_t[] = {{"hw", required_argument, NULL, 'c'},
+                              {"chip", required_argument, NULL, 'r'},
+                              {"debug", no_argument, NULL, 'd'},
+                              {"help", no_argument, NULL, 'h'},
+                              {"chip-id", required_argument, NULL, 'i'},
+                              {"frequency", required_argument, NULL, 'f'},
+                              {"time", required_argument, NULL, 't'},
+                              {"events", required_argument, NULL, 'n'},
+                              {"interval", required_argument, NULL, 'u'},
+                              {"metrics", required_argument, NULL, 'm'},
+                              {0, 0, 0, 0}};
+
+// set from the SIGINT handler, to end a free-running acquisition
+std::atomic<bool> stop_requested{false};
+
+void handle_sigint(int) {
+    stop_requested = true;
+}
+
+void set_cores(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe, std::array<uint16_t, 4> cores, bool use_ptot = false) {
+    namespace rh = rd53b::helpers;
+    rd53b::command::CommandBatch batch;
+    rh::set_core_columns(batch, *fe, cores);
+    if(use_ptot) {
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn0, cores[0]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn1, cores[1]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn2, cores[2]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn3, cores[3]);
+    }
+    batch.send(hw);
+}
+
+void print_help() {
+    std::cout << "=========================================================="
+              << std::endl;
+	std::cout << " ITkPix continuous acquisition" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Free-running internal triggers, read out and decoded while they" << std::endl;
+    std::cout << " run, with the delivered rates reported live. The acquisition" << std::endl;
+    std::cout << " ends after the time or event budget, or on Ctrl-C." << std::endl;
+    std::cout << std::endl;
+    std::cout << " Usage: [CMD] [OPTIONS]" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Options:" << std::endl;
+    std::cout << "   --hw         JSON configuration file for hw controller"
+              << std::endl;
+    std::cout << "   --chip       JSON connectivity configuration for RD53B"
+              << std::endl;
+    std::cout << "   -p           use PToT" << std::endl;
+    std::cout << "   -i|--chip-id Chip ID (must be same as the ChipId field in the chip JSON config" << std::endl;
+    std::cout << "   -f|--frequency  trigger frequency in Hz [default: 5000]" << std::endl;
+    std::cout << "   -t|--time       stop after this many seconds [default: no limit]" << std::endl;
+    std::cout << "   -n|--events     stop after this many decoded events [default: no limit]" << std::endl;
+    std::cout << "   -u|--interval   rate readback interval in ms [default: 1000]" << std::endl;
+    std::cout << "   -m|--metrics    write the per-stage metrics to this JSON file [optional]" << std::endl;
+    std::cout << "   -d|--debug turn on debug-level" << std::endl;
+    std::cout << "   -h|--help  print this help message" << std::endl;
+    std::cout << "=========================================================="
+              << std::endl;
+}
+
+void wait(std::unique_ptr<SpecController>& hw) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    rd53b::wait::cmd_empty(hw);
+}
+
+int main(int argc, char* argv[]) {
+	std::string defaultLogPattern = "[%T:%e]%^[%=8l]:%$ %v";
+	spdlog::set_pattern(defaultLogPattern);
+
+    unsigned set_chip_id = 0xf;
+    unsigned set_chip_id_ls = 0x0;
+
+    std::string chip_config_filename = "";
+    std::string hw_config_filename = "";
+    std::string metrics_filename = "";
+	bool verbose = false;
+    bool use_ptot = false;
+    float trigger_frequency = 5000;
+    float run_time = 0;
+    uint64_t max_events = 0;
+    unsigned interval_ms = 1000;
+    int c;
+    while ((c = getopt_long(argc, argv, "c:dr:hpi:f:t:n:u:m:", longopts_t, NULL)) != -1) {
+        switch (c) {
+            case 'c':
+                hw_config_filename = optarg;
+                break;
+            case 'r':
+                chip_config_filename = optarg;
+                break;
+            case 'd':
+				verbose = true;
+                break;
+            case 'h':
+                print_help();
+                return 0;
+                break;
+            case 'p':
+                use_ptot = true;
+                break;
+            case 'i':
+                set_chip_id = 0xffff & atoi(optarg);
+                set_chip_id_ls = (set_chip_id & 0x3); // lower 2 bits
+                break;
+            case 'f':
+                trigger_frequency = std::stof(optarg);
+                break;
+            case 't':
+                run_time = std::stof(optarg);
+                break;
+            case 'n':
+                max_events = std::stoull(optarg);
+                break;
+            case 'u':
+                interval_ms = std::stoul(optarg);
+                break;
+            case 'm':
+                metrics_filename = optarg;
+                break;
+            case '?':
+            default:
+				LOGGER(error)("Invalid command-line argument provided: {}", char(c));
+                return 1;
+        }  // switch
+    }      // while
+
+    if(verbose) {
+        spdlog::set_level(spdlog::level::debug);
+    }
+
+    // check the inputs
+    fs::path hw_config_path(hw_config_filename);
+    fs::path chip_config_path(chip_config_filename);
+    if (!fs::exists(hw_config_path)) {
+		LOGGER(error)("Provided HW config file (=\"{}\") does not exist!", hw_config_filename);
+        return 1;
+    }
+    if (!fs::exists(chip_config_path)) {
+		LOGGER(error)("Provided chip config file (=\"{}\") does not exist!", chip_config_filename);
+        return 1;
+    }
+    if (trigger_frequency <= 0 || interval_ms == 0) {
+        LOGGER(error)("The trigger frequency and the readback interval must be positive");
+        return 1;
+    }
+
+    namespace rh = rd53b::helpers;
+    namespace rd = rd53b::decoder;
+    auto hw = rh::spec_init(hw_config_filename);
+    auto fe = rh::rd53b_init(hw, chip_config_filename);
+
+    if(fe->getChipId() != set_chip_id) {
+        LOGGER(error)("Chip-ID from chip JSON configuration (={}) does not equal the one specified by the user (={})!", fe->getChipId(), set_chip_id);
+        throw std::runtime_error("Error in setting chip id!");
+    }
+
+    auto cfg = dynamic_cast<FrontEndCfg*>(fe.get());
+
+    hw->setCmdEnable(cfg->getTxChannel());
+    hw->setTrigEnable(0x0);
+    rh::rd53b_configure(hw, fe);
+    wait(hw);
+    hw->flushBuffer();
+    hw->setCmdEnable(cfg->getTxChannel());
+    hw->setRxEnable(cfg->getRxChannel());
+    hw->runMode();
+
+    // pre-scan
+    json pre_scan_cfg = {{"InjDigEn", 1},
+                        {"Latency", 60},
+                        {"EnChipId", 1},
+                        {"DataEnEos", 1},
+                        {"NumOfEventsInStream", 1},
+                        {"DataEnBinaryRo", 0}, // drop ToT
+                        {"DataEnRaw", 0}, // drop hit map compression (always 16-bit hit maps)
+                        {"InjVcalHigh", 2000},
+                        {"InjVcalMed", 200}};
+    if(use_ptot) {
+        pre_scan_cfg["TotEnPtot"] = 1;
+        pre_scan_cfg["TotEnPtoa"] = 1;
+        pre_scan_cfg["TotPtotLatency"] = 2;
+    }
+    for(auto j: pre_scan_cfg.items()) {
+        fe->writeNamedRegister(j.key(), j.value());
+    }
+    wait(hw);
+
+    // disable all pixels but the specific ones
+    rd53b::command::PixelShadow pixels(*fe, /*uploaded*/ true);
+    pixels.fill(false, false, false);
+    std::vector<std::pair<unsigned, unsigned>> pixel_addresses {
+        {0,0},
+        {0,1},
+    };
+    for(auto pix_address : pixel_addresses) {
+        auto col = std::get<0>(pix_address);
+        auto row = std::get<1>(pix_address);
+        LOGGER(debug)("Enabling pix (col,row) = ({},{})", col, row);
+        pixels.set(col, row, !use_ptot, true, use_ptot);
+    }
+    pixels.upload(hw, *fe);
+    wait(hw);
+
+    // enable cores
+    std::array<uint16_t, 4> cores = {0x0, 0x0, 0x0, 0x0};
+    set_cores(hw, fe, cores, use_ptot);
+    wait(hw);
+    cores[0] = 0x1;
+    set_cores(hw, fe, cores, use_ptot);
+    wait(hw);
+
+    // free-running triggers: without a time budget the trigger logic is
+    // given a day, and the acquisition is ended from here
+    hw->setCmdEnable(cfg->getTxChannel());
+    rd53b::trigger::TriggerConfig trigger_config;
+    trigger_config.mode = INT_TIME;
+    trigger_config.frequency = trigger_frequency;
+    trigger_config.time = run_time > 0 ? run_time : 24 * 3600;
+    trigger_config.edge_duration = 20;
+    rd53b::trigger::TriggerLoader trigger_loader;
+    rh::spec_init_trigger(hw, trigger_config, trigger_loader);
+    wait(hw);
+
+    LOGGER(error)("Hard-coding the assumed LS-bits of Chip-Id to be equal to {}!", set_chip_id_ls);
+    uint8_t chip_id = set_chip_id_ls;
+    rd::EventBuffer events;
+    rd::DecodeErrors decode_errors;
+    std::vector<uint16_t> tags;
+    rd53b::readout::RateCounts counts;
+
+    // streams are decoded as soon as they are complete, while the triggers
+    // are still running
+    rd::StreamBuilder builder([&](const rd::Stream& stream) {
+        if(stream.chip_id != chip_id) return;
+        events.clear();
+        tags.clear();
+        // corrupted streams are counted and skipped rather than ending the run;
+        // the tags count the triggers answered, with or without hits
+        rd::decode_stream(stream, events, tags, decode_errors, /*drop tot*/ false, /*do compressed hitmap*/ true, /*use_ptot*/ use_ptot);
+        counts.n_tags += tags.size();
+        counts.n_events += events.n_events();
+        for(size_t ievent = 0; ievent < events.n_events(); ievent++) {
+            counts.n_hits += events.n_hits(ievent);
+        }
+    });
+
+    // begin triggers
+    hw->runMode();
+    fe->sendClear(0xf & set_chip_id);
+    wait(hw);
+    hw->flushBuffer();
+    wait(hw);
+
+    std::signal(SIGINT, handle_sigint);
+    rd53b::metrics::reset();
+    rd53b::readout::ReadoutThread readout(hw);
+    rd53b::readout::RateMonitor monitor(trigger_config.frequency, trigger_config.multiplier,
+                                        std::chrono::milliseconds(interval_ms));
+    readout.start();
+    hw->setTrigEnable(0x1);
+    monitor.start();
+
+    if(hw->getTrigEnable() == 0) {
+        LOGGER(error)("Trigger is not enabled!");
+        throw std::runtime_error("Trigger is not enabled but waiting for triggers!");
+    }
+
+    LOGGER(info)("Triggering at {} Hz ({} triggers per pulse){}", trigger_config.frequency,
+            trigger_config.multiplier, run_time > 0 ? " for " + std::to_string(run_time) + " s" : "");
+    bool stopping = false;
+    std::unique_ptr<RawData> data;
+    auto consume = [&]() {
+        builder.push(data->buf, data->words);
+        counts.n_words += data->words;
+    };
+    while(true) {
+        if(readout.try_next(data)) {
+            consume();
+        } else if(readout.finished()) {
+            // the last buffers, rethrowing any error of the drain thread
+            while(readout.next(data)) consume();
+            break;
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+        counts.n_errors = decode_errors.total();
+        counts.n_ring_full = readout.n_ring_full();
+        if(monitor.update(counts)) {
+            const auto& s = monitor.last();
+            LOGGER(info)("[{:7.1f} s] triggers {:10.0f}/s (configured), tags {:10.0f}/s ({:6.2f}%), events {:10.0f}/s, hits {:10.0f}/s, {:8.3f} MB/s{}",
+                    s.elapsed_s, s.configured_trigger_rate, s.tag_rate, 100 * s.efficiency, s.event_rate, s.hit_rate,
+                    4 * s.word_rate / 1e6, s.data_loss ? "  << DATA LOSS" : "");
+        }
+
+        if(!stopping && (stop_requested || (max_events > 0 && counts.n_events >= max_events))) {
+            // the drain thread still drains the remaining data, read above
+            LOGGER(info)("Stopping the triggers after {} events", counts.n_events);
+            hw->setTrigEnable(0x0);
+            readout.request_stop();
+            stopping = true;
+        }
+    }
+    readout.stop();
+    hw->setTrigEnable(0x0);
+    builder.flush();
+    std::signal(SIGINT, SIG_DFL);
+
+    counts.n_errors = decode_errors.total();
+    counts.n_ring_full = readout.n_ring_full();
+    auto total = monitor.total(counts);
+    LOGGER(debug)("Read {} buffers ({} 32-bit words), max ring depth {}, ring full {} times",
+            readout.n_buffers(), readout.n_words(), readout.max_ring_depth(), readout.n_ring_full());
+    LOGGER(debug)("Built {} streams from {} blocks ({} blocks before the first stream)",
+            builder.n_streams(), builder.n_blocks(), builder.n_orphan_blocks());
+    LOGGER(info)("-------------------------------------------------------------------");
+    LOGGER(info)("Ran {:.1f} s: {} tags ({:.2f}% of the configured triggers), {} events, {} hits, {} words ({:.0f} events/s, {:.3f} MB/s)",
+            total.elapsed_s, counts.n_tags, 100 * total.efficiency, counts.n_events, counts.n_hits,
+            counts.n_words, total.event_rate, 4 * total.word_rate / 1e6);
+    LOGGER(info)("{} of {} readback intervals with data loss", monitor.n_lossy_samples(), monitor.n_samples());
+    if(monitor.max_sustained_rate() > 0) {
+        // the configured rate: the firmware does not count the triggers it sends
+        LOGGER(info)("Sustained the configured trigger rate: {:.0f} triggers/s", monitor.max_sustained_rate());
+    } else if(monitor.n_samples() > 0) {
+        LOGGER(warn)("Configured trigger rate of {:.0f} triggers/s not sustained", total.configured_trigger_rate);
+    }
+    if(decode_errors.total() > 0) {
+        LOGGER(warn)("Dropped {} corrupted streams for chip-id {}:", decode_errors.total(), chip_id);
+        for(unsigned ierror = 0; ierror < rd::n_decode_errors; ierror++) {
+            auto error = static_cast<rd::DecodeError>(ierror);
+            if(decode_errors.count(error) == 0) continue;
+            LOGGER(warn)("    {}: {}", rd::to_string(error), decode_errors.count(error));
+        }
+    }
+
+    if(metrics_filename != "") {
+        if(!rd53b::metrics::enabled) {
+            LOGGER(warn)("Built without ITKPIX_INSTRUMENTATION, the metrics will be empty");
+        }
+        rd53b::metrics::write_summary(metrics_filename);
+        LOGGER(info)("Wrote the metrics to: {}", metrics_filename);
+    }
+
+    return 0;
+}
@@ -16,19 +16,15 @@ namespace fs = std::experimental::filesystem;
 #include "ScanHelper.h"
 #include "SpecController.h"
 #include "RawData.h"
-#include "LUT_PlainHMapToColRow.h"
-#include "LUT_BinaryTreeRowHMap.h"
-#include "LUT_BinaryTreeHitMap.h"
 
 //itkpix_dataflow
+#include "rd53b_command_batch.h"
 #include "rd53b_helpers.h"
-
-const uint8_t PToT_maskStaging[4][4] = {
-    {0, 1, 2, 3},
-    {4, 5, 6, 7},
-    {2, 3, 0, 1},
-    {6, 7, 4, 5}};
-
+#include "rd53b_pixel_shadow.h"
+#include "rd53b_wait.h"
+#include "rd53b_decoder.h"
+#include "rd53b_readout.h"
+#include "rd53b_stream_builder.h"
 
 #define LOGGER(x) spdlog::x
 
@@ -39,15 +35,17 @@ struct option longopts_t[] = {{"hw", required_argument, NULL, 'c'},
                               {"chip-id", required_argument, NULL, 'i'},
                               {0, 0, 0, 0}};
 
-void set_cores(std::unique_ptr<Rd53b>& fe, std::array<uint16_t, 4> cores, bool use_ptot = false) {
+void set_cores(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe, std::array<uint16_t, 4> cores, bool use_ptot = false) {
     namespace rh = rd53b::helpers;
-    rh::set_core_columns(fe, cores);
+    rd53b::command::CommandBatch batch;
+    rh::set_core_columns(batch, *fe, cores);
     if(use_ptot) {
-        fe->writeRegister(&Rd53b::PtotCoreColEn0, cores[0]);
-        fe->writeRegister(&Rd53b::PtotCoreColEn1, cores[1]);
-        fe->writeRegister(&Rd53b::PtotCoreColEn2, cores[2]);
-        fe->writeRegister(&Rd53b::PtotCoreColEn3, cores[3]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn0, cores[0]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn1, cores[1]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn2, cores[2]);
+        batch.write_register(*fe, &Rd53b::PtotCoreColEn3, cores[3]);
     }
+    batch.send(hw);
 }
 
 void print_help() {
@@ -72,206 +70,7 @@ void print_help() {
 
 void wait(std::unique_ptr<SpecController>& hw) {
     std::this_thread::sleep_for(std::chrono::microseconds(100));
-    while(!hw->isCmdEmpty()) {}
-}
-
-struct Stream {
-    Stream() {
-        chip_id = 0;
-        blocks.clear();
-    }
-    ~Stream() {
-        chip_id = 0;
-        blocks.clear();
-    }
-    uint8_t chip_id;
-    std::vector<uint64_t> blocks;
-};
-
-struct Hit {
-
-    Hit() {
-        col =  0;
-        row = 0;
-        tot = 0;
-        ptot = 0;
-        ptoa = 0;
-    }
-    ~Hit() {
-        col = 0;
-        row = 0;
-        tot = 0;
-        ptot = 0;
-        ptoa = 0;
-    }
-    unsigned col;
-    unsigned row;
-    unsigned tot;
-    unsigned ptot;
-    unsigned ptoa;
-};
-
-struct Event {
-    Event() {
-        tag = 0;
-        hits.clear();
-    }
-    unsigned tag;
-    std::vector<Hit> hits;
-};
-
-uint32_t retrieve(unsigned& start_pos, unsigned length, const std::vector<uint64_t>& data) {
-    uint32_t value = 0;
-    unsigned data_block_idx_start = (start_pos / 64);
-    unsigned end_pos = start_pos + length;
-    unsigned data_block_idx_end = (end_pos / 64);
-
-    unsigned start_pos_rev = 64 - start_pos;
-    unsigned end_pos_rev = 64 - end_pos;
-    unsigned mask = (1 << length) - 1;
-
-    if(data_block_idx_end != data_block_idx_start) {
-        unsigned n_over = (end_pos % 64);
-        unsigned length_first = length - n_over;
-        unsigned mask_first = (1 << length_first) - 1;
-        unsigned mask_second = (1 << n_over) - 1;
-
-        uint32_t value0 = data[data_block_idx_start] & mask_first;
-        uint32_t value1 = (data[data_block_idx_end] >> ((63-3) - (n_over-1))) & mask_second;
-        value = (value0 << n_over) | value1;
-    } else {
-        value = (data[data_block_idx_start] >> end_pos_rev) & mask;
-    }
-
-    start_pos += length;
-    return value;
-}
-
-
-//std::vector<Event> decode_stream(const std::vector<uint64_t>& data, bool drop_tot = false) {
-std::vector<Event> decode_stream(Stream& stream, bool drop_tot = false, bool do_compressed_hitmap = false, bool use_ptot = false) {
-    //std::vector<uint64_t> = data.blocks;
-    std::vector<uint64_t> data = stream.blocks;
-    unsigned pos = 0;
-    uint8_t ns_bit = retrieve(pos, 1, data);
-    uint8_t ch_id = retrieve(pos, 2, data);
-    uint16_t tag = retrieve(pos, 8, data);
-    //LOGGER(info)("Decode: NS = {}, ch_id = {}, tag = {}", ns_bit, ch_id, tag);
-
-    // loop over all events in the stream
-    std::vector<Event> events;
-    Event current_event;
-    current_event.tag = tag;
-    unsigned n_hits = 0;
-    while(true) {
-
-        uint16_t ccol = retrieve(pos, 6, data);
-
-        // if ccol is 0 this is the end of stream marker and nothing beyond it is valid data
-        if(ccol == 0) {
-            events.push_back(current_event);
-            //LOGGER(warn)("HIT EOS MARKER!");
-            break;
-        }
-
-        // valid ccol are < 56 (0b111000) and any ccol greater or equal to 56 indicates that
-        // the next field is an internal tag, not a ccol!
-        if(ccol >= 56) {
-            events.push_back(current_event);
-            tag = (ccol << 5) | retrieve(pos, 5, data); // get the rest of the 11-bit internal tag
-            current_event.tag = tag;
-            current_event.hits.clear();
-            continue; // go back to the start of the hit loop
-        }
-
-        // loop over all hits in the event
-        uint8_t qrow = 0;
-        uint8_t is_last = 0;
-        do {
-            is_last = retrieve(pos, 1, data);
-            uint8_t is_neighbor = retrieve(pos, 1, data);
-            if(is_neighbor == 1) {
-                qrow = qrow + 1;
-            } else {
-                qrow = retrieve(pos, 8, data);
-            }
-
-
-            uint32_t hitmap = retrieve(pos, 16, data);
-            if(do_compressed_hitmap) {
-                uint16_t hitmap_raw = (hitmap & 0xffff);
-                hitmap = (RD53BDecoding::_LUT_BinaryTreeHitMap[hitmap_raw] & 0xFFFF);
-                uint8_t hitmap_rollBack = ((RD53BDecoding::_LUT_BinaryTreeHitMap[hitmap_raw] & 0xFF000000) >> 24);
-                if(hitmap_rollBack > 0) {
-                    if(hitmap_rollBack != 0xff) {
-                        pos = pos - hitmap_rollBack;
-                    }
-                    uint16_t rowMap = retrieve(pos, 14, data);
-                    hitmap |= (RD53BDecoding::_LUT_BinaryTreeRowHMap[rowMap] << 8);
-                    pos -= (RD53BDecoding::_LUT_BinaryTreeRowHMap[rowMap] & 0xFF00) >> 8;
-                } else {
-                    pos -= (RD53BDecoding::_LUT_BinaryTreeHitMap[hitmap_raw] & 0xFF0000) >> 16;
-                }
-                
-            }
-
-            if(qrow >= 196) {
-                for(unsigned ibus = 0; ibus < 4; ibus++) {
-                    uint8_t hitbus = (hitmap >> (ibus << 2)) & 0xf;
-                    if(hitbus) {
-                        uint16_t ptot_ptoa_buf = 0xffff;
-                        for(unsigned iread = 0; iread < 4; iread++) {
-                            if((hitbus >> iread) & 0x1) {
-                                ptot_ptoa_buf &= ~((~retrieve(pos, 4, data) & 0xf) << (iread<<2));
-                            }
-                        } // iread
-                        uint16_t ptot = ptot_ptoa_buf & 0x7ff;
-                        uint16_t ptoa = ptot_ptoa_buf >> 11;
-                        unsigned step = 0;
-                        uint16_t pix_col = (ccol -1 ) * 8 + PToT_maskStaging[step % 4][ibus] + 1;
-                        uint16_t pix_row = step / 2 + 1;
-                        Hit hit;
-                        hit.col = pix_col;
-                        hit.row = pix_row;
-                        hit.ptot = ptot;
-                        hit.ptoa = ptoa;
-                        n_hits++;
-                        current_event.hits.push_back(hit);
-                    } // if hitbus
-                } // ibus
-            } // qrow >= 196
-            else if(!use_ptot){
-
-                // not considering compressed hitmaps right now
-                auto arr_size = RD53BDecoding::_LUT_PlainHMap_To_ColRow_ArrSize[hitmap] << 2;
-                if(arr_size == 0) {
-                    LOGGER(error)("Received fragment with no ToT! ({}, {})", ccol, qrow);
-                    throw std::runtime_error("Decoding error");
-                }
-                uint64_t tot = drop_tot ? 0 : retrieve(pos, arr_size, data);
-                for(unsigned ihit = 0; ihit < arr_size; ihit++) {
-                    uint8_t pix_tot = (tot >> (ihit << 2)) & 0xf;
-                    uint16_t pix_col = ((ccol - 1) * 8) + (RD53BDecoding::_LUT_PlainHMap_To_ColRow[hitmap][ihit] >> 4) + 1;
-                    uint16_t pix_row = ((qrow)*2) + (RD53BDecoding::_LUT_PlainHMap_To_ColRow[hitmap][ihit] & 0xF) + 1;
-
-                    // consider tot == 0 to be a "no hit"
-                    if(pix_tot > 0) {
-                        Hit hit;
-                        hit.col = (pix_col-1);
-                        hit.row = (pix_row-1);
-                        hit.tot = pix_tot;
-                        n_hits++;
-                        current_event.hits.push_back(hit);
-                    } // non-empty tot value
-                } // ihit
-            } 
-        } while(!is_last);
-        //events.push_back(current_event);
-    } // event loop
-    if(n_hits == 0) {
-        events.clear();
-    }
-    return events;
+    rd53b::wait::cmd_empty(hw);
 }
 
 int main(int argc, char* argv[]) {
@@ -328,6 +127,7 @@ int main(int argc, char* argv[]) {
     }
 
     namespace rh = rd53b::helpers;
+    namespace rd = rd53b::decoder;
     auto hw = rh::spec_init(hw_config_filename);
     auto fe = rh::rd53b_init(hw, chip_config_filename);
 
@@ -415,39 +215,32 @@ int main(int argc, char* argv[]) {
     }
     wait(hw);
 
-    // disable all pixels
-    rh::disable_pixels(fe);
+    // disable all pixels but the specific ones, in a single upload of what
+    // differs from the configuration written above
+    rd53b::command::PixelShadow pixels(*fe, /*uploaded*/ true);
+    pixels.fill(false, false, false);
 
     // enable specific pixels
     std::vector<std::pair<unsigned, unsigned>> pixel_addresses {
         {0,0},
         {0,1},
     };//, {8, 2}};
-    for(unsigned col = 0; col < Rd53b::n_Col; col++) {
-        for(unsigned row = 0; row < Rd53b::n_Row; row++) {
-            fe->setEn(col, row, 0);
-            fe->setInjEn(col, row, 0);
-            fe->setHitbus(col, row, 0);
-        }
-    }
     for(auto pix_address : pixel_addresses) {
         auto col = std::get<0>(pix_address);
         auto row = std::get<1>(pix_address);
         LOGGER(warn)("Enabling pix (col,row) = ({},{})", col, row);
-        fe->setEn(col, row, use_ptot ? 0 : 1);
-        fe->setInjEn(col, row, 1);
-        fe->setHitbus(col, row, use_ptot ? 1 : 0);
+        pixels.set(col, row, !use_ptot, true, use_ptot);
     }
-    fe->configurePixels();
+    pixels.upload(hw, *fe);
     wait(hw);
 
     // enable cores
     std::array<uint16_t, 4> cores = {0x0, 0x0, 0x0, 0x0};
-    set_cores(fe, cores);
-    set_cores(fe, cores, use_ptot);
+    set_cores(hw, fe, cores);
+    set_cores(hw, fe, cores, use_ptot);
     wait(hw);
     cores[0] = 0x1;//0x1 | 0x4 | 0x10;
-    set_cores(fe, cores, use_ptot);
+    set_cores(hw, fe, cores, use_ptot);
     wait(hw);
 
     // enable triggers
@@ -478,91 +271,64 @@ int main(int argc, char* argv[]) {
     }
 
 
-    uint32_t done = 0;
-    RawData* data = nullptr;
-    unsigned total_word_count_32 = 0;
-    std::vector<uint32_t> data_vec;
-    while(done == 0) {
-        done = hw->isTrigDone();
-        do {
-            data = hw->readData();
-            if(data != nullptr) {
-                for(size_t i = 0; i < data->words; i++) {
-                    data_vec.push_back(data->buf[i]);
-                } // i
-            }
-        } while (data != nullptr);
-    }
-    std::this_thread::sleep_for(hw->getWaitTime());
-    do {
-        data = hw->readData();
-        if(data != nullptr) {
-            for(size_t i = 0; i < data->words; i++) {
-                data_vec.push_back(data->buf[i]);
-            } // i
-        }
-    } while (data != nullptr);
-
-    // create streams of 64-bit words
-    std::vector<uint64_t> blocks;
-    for(size_t i =  0; i < data_vec.size(); i+=2) {
-        uint64_t data0 = static_cast<uint64_t>(data_vec.at(i));
-        uint64_t data1 = static_cast<uint64_t>(data_vec.at(i+1));
-        uint64_t data = data1 | (data0 << 32);
-        std::bitset<64> bits(data);
-        std::cout << "block: " << bits.to_string() << std::endl;
-        blocks.push_back(data);
-    }
-
-    std::map<unsigned, std::vector<Stream>> stream_map;
-    std::map<unsigned, unsigned> stream_in_progress_status;
-    std::map<unsigned, std::vector<uint64_t>> stream_in_progress;
-
-    LOGGER(error)("Hard-coding the assumed LS-bits of Chip-Id to be equal to {}!", set_chip_id_ls);
-    stream_in_progress[set_chip_id_ls];
-    
-    for(size_t block_num =  0; block_num < (data_vec.size()/2); block_num++) {
-        auto data = blocks[block_num];
-        uint8_t ns_bit = (data >> 63) & 0x1;
-        uint8_t ch_id = (data >> 61) & 0x3;
-        if(ns_bit == 1) {
-            if(stream_in_progress.at(ch_id).size() > 0) {
-                Stream st;
-                st.chip_id = ch_id;
-                st.blocks = stream_in_progress.at(ch_id);
-                stream_map[ch_id].push_back(st);
-                stream_in_progress[ch_id].clear();
-            }
-        }
-        stream_in_progress[ch_id].push_back(data);
-    }
-
     LOGGER(error)("Hard-coding the assumed LS-bits of Chip-Id to be equal to {}!", set_chip_id_ls);
     uint8_t chip_id = set_chip_id_ls;
-    std::vector<Event> events;
+    rd::EventBuffer events;
+    rd::DecodeErrors decode_errors;
     unsigned n_hits_total = 0;
-    for(size_t i = 0; i < stream_map[chip_id].size(); i++) {
-        auto stream = stream_map[chip_id][i];
-        events = decode_stream(stream, /*drop tot*/ false, /*do compressed hitmap*/ true, /*use_ptot*/ use_ptot);
-        if(events.size()>0) {
+
+    // streams are decoded as soon as they are complete, while the readout is
+    // still running
+    rd::StreamBuilder builder([&](const rd::Stream& stream) {
+        for(auto block : stream.blocks) {
+            std::bitset<64> bits(block);
+            std::cout << "block: " << bits.to_string() << std::endl;
+        }
+        if(stream.chip_id != chip_id) return;
+        events.clear();
+        // corrupted streams are counted and skipped rather than ending the run
+        rd::decode_stream(stream, events, decode_errors, /*drop tot*/ false, /*do compressed hitmap*/ true, /*use_ptot*/ use_ptot);
+        if(events.n_events()>0) {
             LOGGER(info)("-------------------------------------------------------------------");
-            LOGGER(info)("Stream for Chip {} has {} events", stream.chip_id, events.size());
-            for(auto event : events) {
-                LOGGER(info)("   TAG: {}", event.tag);
-                auto hits = event.hits;
-                n_hits_total += hits.size();
-                if(hits.size() == 0) {
+            LOGGER(info)("Stream for Chip {} has {} events", stream.chip_id, events.n_events());
+            for(size_t ievent = 0; ievent < events.n_events(); ievent++) {
+                LOGGER(info)("   TAG: {}", events.tag(ievent));
+                size_t hit_begin = events.hit_begin(ievent);
+                size_t n_hits = events.n_hits(ievent);
+                n_hits_total += n_hits;
+                if(n_hits == 0) {
                     LOGGER(info)("        EMPTY!");
                 } else {
-                    for(size_t ihit = 0; ihit < hits.size(); ihit++) {
-                        LOGGER(info)("        Hit[{:02d}]: (col, row) = ({}, {}) -> ToT = {}, PToT = {}, PToA = {}", ihit, hits.at(ihit).col, hits.at(ihit).row, hits.at(ihit).tot, hits.at(ihit).ptot, hits.at(ihit).ptoa);
+                    for(size_t ihit = 0; ihit < n_hits; ihit++) {
+                        size_t h = hit_begin + ihit;
+                        LOGGER(info)("        Hit[{:02d}]: (col, row) = ({}, {}) -> ToT = {}, PToT = {}, PToA = {}", ihit, events.col()[h], events.row()[h], events.tot()[h], events.ptot(h), events.ptoa(h));
                     } // ihit
                 }
             } // event
         } // non-empty event
-    } // i
+    });
+
+    rd53b::readout::ReadoutThread readout(hw);
+    readout.start();
+    std::unique_ptr<RawData> data;
+    while(readout.next(data)) {
+        builder.push(data->buf, data->words);
+    }
+    builder.flush();
+    LOGGER(debug)("Read {} buffers ({} 32-bit words), max ring depth {}, ring full {} times",
+            readout.n_buffers(), readout.n_words(), readout.max_ring_depth(), readout.n_ring_full());
+    LOGGER(debug)("Built {} streams from {} blocks ({} blocks before the first stream)",
+            builder.n_streams(), builder.n_blocks(), builder.n_orphan_blocks());
     LOGGER(info)("-------------------------------------------------------------------");
     LOGGER(warn)("Total number of hits seen for chip-id {}: {}", chip_id, n_hits_total);
+    if(decode_errors.total() > 0) {
+        LOGGER(warn)("Dropped {} corrupted streams for chip-id {}:", decode_errors.total(), chip_id);
+        for(unsigned ierror = 0; ierror < rd::n_decode_errors; ierror++) {
+            auto error = static_cast<rd::DecodeError>(ierror);
+            if(decode_errors.count(error) == 0) continue;
+            LOGGER(warn)("    {}: {}", rd::to_string(error), decode_errors.count(error));
+        }
+    }
 
     
 
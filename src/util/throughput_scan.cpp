@@ -0,0 +1,446 @@
+//std/stl
+#include <iostream>
+#include <experimental/filesystem>
+#include <fstream>
+#include <memory>  // unique_ptr
+#include <sstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <getopt.h>
+#include <iomanip>
+namespace fs = std::experimental::filesystem;
+
+//YARR
+#include "logging.h"
+#include "LoggingConfig.h"
+#include "Bookkeeper.h"
+#include "Rd53b.h"
+#include "ScanHelper.h"
+#include "SpecController.h"
+#include "RawData.h"
+
+//itkpix_dataflow
+#include "rd53b_command_batch.h"
+#include "rd53b_config_scheduler.h"
+#include "rd53b_helpers.h"
+#include "rd53b_pixel_shadow.h"
+#include "rd53b_register_shadow.h"
+#include "rd53b_wait.h"
+#include "rd53b_channel_demux.h"
+#include "rd53b_decoder.h"
+#include "rd53b_metrics.h"
+#include "rd53b_readout.h"
+#include "rd53b_stream_builder.h"
+#include "rd53b_trigger.h"
+
+#define LOGGER(x) spdlog::x
+
+struct option longopts_t[] = {{"hw", required_argument, NULL, 'r'},
+                              {"primary", required_argument, NULL, 'p'},
+                              {"secondary", required_argument, NULL, 's'},
+                              {"frequencies", required_argument, NULL, 'f'},
+                              {"pixels", required_argument, NULL, 'x'},
+                              {"cores", required_argument, NULL, 'k'},
+                              {"count", required_argument, NULL, 'n'},
+                              {"output", required_argument, NULL, 'o'},
+                              {"metrics", required_argument, NULL, 'm'},
+                              {"debug", no_argument, NULL, 'd'},
+                              {"help", no_argument, NULL, 'h'},
+                              {0, 0, 0, 0}};
+
+void wait(std::unique_ptr<SpecController>& hw) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    rd53b::wait::cmd_empty(hw);
+}
+
+void send_reset(std::unique_ptr<SpecController>& hw, std::unique_ptr<Rd53b>& fe, unsigned signal, rd53b::command::GlobalShadow* shadow = nullptr) {
+    LOGGER(info)("Sending reset signal to Chip {}: {:x}", fe->getChipId(), 0xffff & signal);
+    rd53b::command::CommandBatch batch;
+    batch.write_register(*fe, &Rd53b::GlobalPulseConf, signal, shadow);
+    batch.write_register(*fe, &Rd53b::GlobalPulseWidth, 10, shadow);
+    batch.global_pulse(fe->getChipId());
+    batch.wait(std::chrono::microseconds(100));
+    batch.write_register(*fe, &Rd53b::GlobalPulseConf, 0, shadow);
+    batch.send(hw);
+}
+
+void write_config(std::unique_ptr<SpecController>& hw, const json& config, std::unique_ptr<Rd53b>& fe, rd53b::command::GlobalShadow* shadow = nullptr) {
+    rd53b::command::CommandBatch batch;
+    for(auto j: config.items()) {
+        batch.write_named_register(*fe, j.key(), j.value(), shadow);
+    }
+    batch.send(hw);
+}
+
+// comma separated list of numbers, e.g. "1000,5000,10000"
+template <typename T>
+std::vector<T> parse_list(const std::string& list) {
+    std::vector<T> values;
+    std::stringstream ss(list);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+        if(item.empty()) continue;
+        values.push_back(static_cast<T>(std::stod(item)));
+    }
+    return values;
+}
+
+// the first n_cores core columns (of 8 pixel columns each)
+std::array<uint16_t, 4> core_mask(unsigned n_cores) {
+    std::array<uint16_t, 4> cores = {0x0, 0x0, 0x0, 0x0};
+    for(unsigned i = 0; i < n_cores && i < 50; i++) {
+        cores[i / 16] |= (0x1 << (i % 16));
+    }
+    return cores;
+}
+
+// n_pixels injected pixels spread over the first n_cores core columns: one
+// per core column in turn, then the next column of each core, then the
+// next row (wrapping around the enabled columns)
+void set_injected_pixels(rd53b::command::PixelShadow& pixels, unsigned n_pixels, unsigned n_cores) {
+    pixels.fill(false, false, false);
+    unsigned n_cols = 8 * n_cores;
+    for(unsigned ipix = 0; ipix < n_pixels; ipix++) {
+        unsigned core = ipix % n_cores;
+        unsigned col = 8 * core + (ipix / n_cores) % 8;
+        unsigned row = (ipix / n_cols) % rd53b::command::PixelShadow::n_row;
+        pixels.set(col, row, true, true, false);
+    }
+}
+
+// the measurement of one chip at one scan point
+struct ChipResult {
+    uint64_t n_events = 0;
+    uint64_t n_hits = 0;
+    uint64_t n_blocks = 0;
+    uint64_t n_errors = 0;
+};
+
+void print_help() {
+    std::cout << "=========================================================="
+              << std::endl;
+	std::cout << " ITkPix throughput scan" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Sweeps the trigger frequency, the number of injected pixels and" << std::endl;
+    std::cout << " the number of enabled core columns, and measures at each point" << std::endl;
+    std::cout << " the delivered blocks/s, decoded hits/s, missing triggers (gaps in" << std::endl;
+    std::cout << " the tags received) and DMA backlog, for one chip or a" << std::endl;
+    std::cout << " PRIMARY/SECONDARY shared link." << std::endl;
+    std::cout << std::endl;
+    std::cout << " Usage: [CMD] [OPTIONS]" << std::endl;
+    std::cout << std::endl;
+    std::cout << " Options:" << std::endl;
+    std::cout << "   --hw              JSON configuration file for hw controller"
+              << std::endl;
+    std::cout << "   -p|--primary      JSON configuration for the (PRIMARY) chip" << std::endl;
+    std::cout << "   -s|--secondary    JSON configuration for the SECONDARY chip [optional]" << std::endl;
+    std::cout << "   -f|--frequencies  trigger frequencies in Hz [default: 1000,5000,10000,50000]" << std::endl;
+    std::cout << "   -x|--pixels       numbers of injected pixels [default: 1,8,64]" << std::endl;
+    std::cout << "   -k|--cores        numbers of enabled core columns [default: 1,10,50]" << std::endl;
+    std::cout << "   -n|--count        trigger pulses per point [default: 1000]" << std::endl;
+    std::cout << "   -o|--output       write the result table to this file [optional]" << std::endl;
+    std::cout << "   -m|--metrics      write the per-stage metrics to this JSON file [optional]" << std::endl;
+    std::cout << "   -d|--debug        turn on debug-level" << std::endl;
+    std::cout << "   -h|--help         print this help message" << std::endl;
+    std::cout << "=========================================================="
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	std::string defaultLogPattern = "[%T:%e]%^[%=8l]:%$ %v";
+	spdlog::set_pattern(defaultLogPattern);
+
+    std::string primary_config_filename = "";
+    std::string secondary_config_filename = "";
+    std::string hw_config_filename = "";
+    std::string output_filename = "";
+    std::string metrics_filename = "";
+    std::vector<float> frequencies = {1000, 5000, 10000, 50000};
+    std::vector<unsigned> pixel_counts = {1, 8, 64};
+    std::vector<unsigned> core_counts = {1, 10, 50};
+    unsigned trigger_count = 1000;
+	bool verbose = false;
+    int c;
+    while ((c = getopt_long(argc, argv, "r:p:s:f:x:k:n:o:m:hd", longopts_t, NULL)) != -1) {
+        switch (c) {
+            case 'r':
+                hw_config_filename = optarg;
+                break;
+            case 'p':
+                primary_config_filename = optarg;
+                break;
+            case 's':
+                secondary_config_filename = optarg;
+                break;
+            case 'f':
+                frequencies = parse_list<float>(optarg);
+                break;
+            case 'x':
+                pixel_counts = parse_list<unsigned>(optarg);
+                break;
+            case 'k':
+                core_counts = parse_list<unsigned>(optarg);
+                break;
+            case 'n':
+                trigger_count = std::stoul(optarg);
+                break;
+            case 'o':
+                output_filename = optarg;
+                break;
+            case 'm':
+                metrics_filename = optarg;
+                break;
+            case 'd':
+				verbose = true;
+                break;
+            case 'h':
+                print_help();
+                return 0;
+                break;
+            case '?':
+            default:
+				LOGGER(error)("Invalid command-line argument provided: {}", char(c));
+                return 1;
+        }  // switch
+    }      // while
+
+    if(verbose) {
+        spdlog::set_level(spdlog::level::debug);
+    }
+
+    // check the inputs
+    fs::path hw_config_path(hw_config_filename);
+    fs::path primary_config_path(primary_config_filename);
+    if (!fs::exists(hw_config_path)) {
+		LOGGER(error)("Provided HW config file (=\"{}\") does not exist!", hw_config_filename);
+        return 1;
+    }
+    if (!fs::exists(primary_config_path)) {
+        LOGGER(error)("Provided config for PRIMARY (=\"{}\") does not exist!", primary_config_filename);
+        return 1;
+    }
+    bool shared_link = secondary_config_filename != "";
+    if (shared_link && !fs::exists(fs::path(secondary_config_filename))) {
+        LOGGER(error)("Provided config for SECONDARY (=\"{}\") does not exist!", secondary_config_filename);
+        return 1;
+    }
+    if (frequencies.empty() || pixel_counts.empty() || core_counts.empty() || trigger_count == 0) {
+        LOGGER(error)("Nothing to scan!");
+        return 1;
+    }
+    for (unsigned n_cores : core_counts) {
+        if (n_cores == 0 || n_cores > 50) {
+            LOGGER(error)("Invalid number of core columns: {} (1 to 50)", n_cores);
+            return 1;
+        }
+    }
+
+    namespace rh = rd53b::helpers;
+    namespace rd = rd53b::decoder;
+    auto hw = rh::spec_init(hw_config_filename);
+
+    std::vector<std::unique_ptr<Rd53b>> fes;
+    fes.push_back(rh::rd53b_init(hw, primary_config_filename));
+    if(shared_link) {
+        fes.push_back(rh::rd53b_init(hw, secondary_config_filename));
+    }
+
+    for(auto& fe : fes) {
+        fe->sendClear(fe->getChipId());
+    }
+
+    // Sync CMD decoder
+    hw->setCmdEnable(fes[0]->getTxChannel());
+    hw->setTrigEnable(0x0);
+    wait(hw);
+    hw->flushBuffer();
+    for(auto& fe : fes) {
+        hw->setRxEnable(fe->getRxChannel());
+    }
+    hw->runMode();
+
+    // configure the chips, with digital injection and one event per stream
+    json pre_scan_cfg = {{"InjDigEn", 1},
+                        {"Latency", 60},
+                        {"EnChipId", 1},
+                        {"DataEnEos", 1},
+                        {"NumOfEventsInStream", 1},
+                        {"InjVcalHigh", 2000},
+                        {"InjVcalMed", 200}};
+    std::vector<rd53b::command::GlobalShadow> shadows(fes.size());
+    std::vector<rd53b::command::PixelShadow> pixels;
+    rd53b::command::ConfigScheduler scheduler;
+    for(size_t ife = 0; ife < fes.size(); ife++) {
+        scheduler.add(*fes[ife], shadows[ife]);
+    }
+    if(shared_link) {
+        // sleep to let SECONDARY catch up the CMD signals from the PRIMARY
+        scheduler.after(1, 0, std::chrono::milliseconds(100));
+    }
+    scheduler.configure(hw);
+    for(size_t ife = 0; ife < fes.size(); ife++) {
+        pixels.emplace_back(*fes[ife], /*uploaded*/ true);
+        write_config(hw, pre_scan_cfg, fes[ife], &shadows[ife]);
+    }
+    wait(hw);
+    hw->flushBuffer();
+
+    uint16_t reset_cmd = 0xB9;
+    if(shared_link) {
+        // the SECONDARY sends AURORA to the PRIMARY, which merges it
+        LOGGER(info)("Setting SerSelOut of the SECONDARY to AURORA");
+        fes[1]->SerSelOut0.write(1);
+        fes[1]->SerSelOut1.write(1);
+        fes[1]->SerSelOut2.write(1);
+        fes[1]->SerSelOut3.write(1);
+        rh::configure_diff(hw, fes[1], shadows[1]);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        send_reset(hw, fes[0], reset_cmd, &shadows[0]);
+        wait(hw);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    bool do_compressed_hitmap = fes[0]->DataEnRaw.read() == 1;
+    bool drop_tot = fes[0]->DataEnBinaryRo.read() == 1;
+    uint8_t channel_mask = 0x0;
+    for(auto& fe : fes) {
+        channel_mask |= 1 << (0x3 & fe->getChipId());
+        if(fe->DataEnRaw.read() != fes[0]->DataEnRaw.read() ||
+                fe->DataEnBinaryRo.read() != fes[0]->DataEnBinaryRo.read()) {
+            LOGGER(error)("The chips do not have the same data format (hit map compression, ToT)!");
+            return 1;
+        }
+    }
+
+    for(auto& fe : fes) {
+        hw->setCmdEnable(fe->getTxChannel());
+    }
+    rd53b::trigger::TriggerConfig trigger_config;
+    trigger_config.count = trigger_count;
+    trigger_config.edge_duration = 20;
+    rd53b::trigger::TriggerLoader trigger_loader;
+    // the tags every trigger pulse should give, in order
+    const std::vector<uint16_t> expected_tags = rd53b::trigger::event_tags(trigger_config);
+
+    std::ofstream output;
+    if(output_filename != "") {
+        output.open(output_filename);
+        if(!output.good()) {
+            LOGGER(error)("Could not open the output file: {}", output_filename);
+            return 1;
+        }
+    }
+    std::stringstream header;
+    header << "#" << std::setw(11) << "frequency" << std::setw(8) << "pixels"
+           << std::setw(6) << "cores" << std::setw(6) << "chip" << std::setw(10) << "triggers"
+           << std::setw(10) << "tags" << std::setw(10) << "events" << std::setw(9) << "missing" << std::setw(11) << "hits"
+           << std::setw(10) << "blocks" << std::setw(8) << "errors" << std::setw(10) << "time_s"
+           << std::setw(13) << "blocks/s" << std::setw(13) << "hits/s"
+           << std::setw(11) << "max_ring" << std::setw(10) << "ring_full";
+    LOGGER(info)("{}", header.str());
+    if(output.is_open()) output << header.str() << std::endl;
+
+    rd53b::metrics::reset();
+    for(unsigned n_cores : core_counts) {
+        auto cores = core_mask(n_cores);
+        for(unsigned n_pixels : pixel_counts) {
+            // only the pixel registers that differ from the previous point are written
+            for(size_t ife = 0; ife < fes.size(); ife++) {
+                set_injected_pixels(pixels[ife], n_pixels, n_cores);
+                pixels[ife].upload(hw, *fes[ife]);
+                rd53b::command::CommandBatch batch;
+                rh::set_core_columns(batch, *fes[ife], cores, &shadows[ife]);
+                batch.send(hw);
+            }
+            wait(hw);
+
+            for(float frequency : frequencies) {
+                trigger_config.frequency = frequency;
+                rh::spec_init_trigger(hw, trigger_config, trigger_loader);
+                wait(hw);
+
+                std::array<ChipResult, rd::ChannelDemux::n_channels> results;
+                rd::EventBuffer events;
+                std::vector<uint16_t> tags;
+                std::array<rd::DecodeErrors, rd::ChannelDemux::n_channels> decode_errors;
+                // the missing triggers are the gaps in the tags each chip sent,
+                // hitless streams included
+                std::vector<rd53b::trigger::TagGaps> tag_gaps(rd::ChannelDemux::n_channels,
+                        rd53b::trigger::TagGaps(expected_tags));
+                rd::StreamBuilder builder([&](const rd::Stream& stream) {
+                    events.clear();
+                    tags.clear();
+                    rd::decode_stream(stream, events, tags, decode_errors[stream.chip_id], drop_tot, do_compressed_hitmap, /*use_ptot*/ false);
+                    for(auto tag : tags) tag_gaps[stream.chip_id].push(tag);
+                    auto& result = results[stream.chip_id];
+                    result.n_events += events.n_events();
+                    for(size_t ievent = 0; ievent < events.n_events(); ievent++) {
+                        result.n_hits += events.n_hits(ievent);
+                    }
+                }, channel_mask);
+
+                for(auto& fe : fes) {
+                    fe->sendClear(fe->getChipId());
+                }
+                wait(hw);
+                hw->flushBuffer();
+                wait(hw);
+
+                rd53b::readout::ReadoutThread readout(hw);
+                readout.start();
+                auto start = std::chrono::steady_clock::now();
+                hw->setTrigEnable(0x1);
+                std::unique_ptr<RawData> data;
+                while(readout.next(data)) {
+                    builder.push(data->buf, data->words);
+                }
+                builder.flush();
+                double time_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                hw->setTrigEnable(0x0);
+
+                uint64_t n_triggers = uint64_t(trigger_count) * expected_tags.size();
+                for(auto& fe : fes) {
+                    uint8_t ch_id = 0x3 & fe->getChipId();
+                    auto& result = results[ch_id];
+                    result.n_blocks = builder.demux().counters(ch_id).n_blocks;
+                    result.n_errors = decode_errors[ch_id].total();
+                    tag_gaps[ch_id].finish(trigger_count);
+                    uint64_t n_missing = tag_gaps[ch_id].n_missing();
+
+                    std::stringstream row;
+                    row << std::fixed << std::setprecision(0)
+                        << std::setw(12) << frequency << std::setw(8) << n_pixels
+                        << std::setw(6) << n_cores << std::setw(6) << fe->getChipId()
+                        << std::setw(10) << n_triggers << std::setw(10) << tag_gaps[ch_id].n_received()
+                        << std::setw(10) << result.n_events
+                        << std::setw(9) << n_missing << std::setw(11) << result.n_hits
+                        << std::setw(10) << result.n_blocks << std::setw(8) << result.n_errors
+                        << std::setprecision(3) << std::setw(10) << time_s << std::setprecision(0)
+                        << std::setw(13) << result.n_blocks / time_s
+                        << std::setw(13) << result.n_hits / time_s
+                        << std::setw(11) << readout.max_ring_depth()
+                        << std::setw(10) << readout.n_ring_full();
+                    LOGGER(info)("{}", row.str());
+                    if(output.is_open()) output << row.str() << std::endl;
+                }
+            } // frequency
+        } // n_pixels
+    } // n_cores
+
+    hw->disableCmd();
+    hw->disableRx();
+
+    if(output.is_open()) {
+        LOGGER(info)("Wrote the result table to: {}", output_filename);
+    }
+    if(metrics_filename != "") {
+        if(!rd53b::metrics::enabled) {
+            LOGGER(warn)("Built without ITKPIX_INSTRUMENTATION, the metrics will be empty");
+        }
+        rd53b::metrics::write_summary(metrics_filename);
+        LOGGER(info)("Wrote the metrics to: {}", metrics_filename);
+    }
+
+    return 0;
+}